@@ -0,0 +1,190 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+
+/**
+ * Checks that the DropOldest and Coalesce policies of the depth packet queue really replace queued packets.
+ * The packet processor of a BasePacketPipeline is held at a gate while more packets than the queue holds arrive.
+ * The parser has to find a free buffer for every packet, so nothing is dropped as busy and nothing is dropped
+ * as the newest packet, and the last packet has to be processed once the gate opens. With DropNewest the queue
+ * refuses the packets instead, which the parser must not count again as dropped busy.
+ *
+ * Usage: BackpressureCheck
+ */
+
+#include <iostream>
+#include <vector>
+#include <cstring>
+
+#include <libfreenect2/threading.h>
+#include <libfreenect2/packet_pipeline.h>
+#include <libfreenect2/depth_packet_stream_parser.h>
+
+static const size_t sub_image_length = 512 * 424 * 11 / 8;
+static const uint32_t num_packets = 8;
+
+class GatedDepthPacketProcessor : public libfreenect2::DepthPacketProcessor
+{
+public:
+  GatedDepthPacketProcessor() : open_(false)
+  {
+  }
+
+  virtual void loadP0TablesFromCommandResponse(unsigned char* /*buffer*/, size_t /*buffer_length*/)
+  {
+  }
+
+  virtual void process(const libfreenect2::DepthPacket &packet)
+  {
+    libfreenect2::unique_lock l(mutex_);
+    sequences_.push_back(packet.sequence);
+    condition_.notify_all();
+
+    while(!open_)
+    {
+      WAIT_CONDITION(condition_, mutex_, l);
+    }
+  }
+
+  /** waits until the worker thread is held at the gate */
+  void waitForPacket()
+  {
+    libfreenect2::unique_lock l(mutex_);
+
+    while(sequences_.empty())
+    {
+      WAIT_CONDITION(condition_, mutex_, l);
+    }
+  }
+
+  void open()
+  {
+    libfreenect2::lock_guard l(mutex_);
+    open_ = true;
+    condition_.notify_all();
+  }
+
+  std::vector<uint32_t> sequences()
+  {
+    libfreenect2::lock_guard l(mutex_);
+    return sequences_;
+  }
+private:
+  libfreenect2::mutex mutex_;
+  libfreenect2::condition_variable condition_;
+  bool open_;
+  std::vector<uint32_t> sequences_;
+};
+
+class GatedPacketPipeline : public libfreenect2::BasePacketPipeline
+{
+public:
+  GatedDepthPacketProcessor *gate;
+
+  GatedPacketPipeline() : gate(0)
+  {
+    initialize();
+  }
+protected:
+  virtual libfreenect2::DepthPacketProcessor *createDepthPacketProcessor()
+  {
+    gate = new GatedDepthPacketProcessor();
+    return gate;
+  }
+};
+
+static void sendDepthPacket(libfreenect2::DataCallback *parser, uint32_t sequence)
+{
+  std::vector<unsigned char> data(sub_image_length + sizeof(libfreenect2::DepthSubPacketFooter));
+
+  for(uint32_t subsequence = 0; subsequence < 10; ++subsequence)
+  {
+    libfreenect2::DepthSubPacketFooter footer;
+    std::memset(&footer, 0, sizeof(footer));
+    footer.magic1 = 9;
+    footer.timestamp = sequence;
+    footer.sequence = sequence;
+    footer.subsequence = subsequence;
+    footer.length = sub_image_length;
+    std::memcpy(&data[sub_image_length], &footer, sizeof(footer));
+
+    parser->onDataReceived(&data[0], data.size());
+  }
+}
+
+static bool check(libfreenect2::BackpressurePolicy::Type type, const char *name)
+{
+  GatedPacketPipeline pipeline;
+  pipeline.getDepthPacketQueue()->setBackpressurePolicy(libfreenect2::BackpressurePolicy(type));
+
+  sendDepthPacket(pipeline.getIrPacketParser(), 1);
+  pipeline.gate->waitForPacket();
+
+  for(uint32_t sequence = 2; sequence <= num_packets; ++sequence)
+    sendDepthPacket(pipeline.getIrPacketParser(), sequence);
+
+  libfreenect2::BackpressureCounters counters = pipeline.getDepthPacketQueue()->backpressureCounters();
+  libfreenect2::ParserStatistics statistics = pipeline.getIrParserStatistics();
+
+  pipeline.gate->open();
+
+  // every packet is either processed or replaced by a newer one
+  std::vector<uint32_t> sequences;
+
+  for(int i = 0; i < 1000; ++i)
+  {
+    sequences = pipeline.gate->sequences();
+
+    if(sequences.size() + counters.dropped_oldest + counters.dropped_newest >= num_packets)
+      break;
+
+    libfreenect2::this_thread::sleep_for(libfreenect2::chrono::milliseconds(1));
+  }
+
+  // every packet is counted exactly once
+  bool ok = statistics.dropped_busy == 0 && !sequences.empty() &&
+      sequences.size() + counters.dropped_oldest + counters.dropped_newest == num_packets;
+
+  if(type == libfreenect2::BackpressurePolicy::DropNewest)
+    ok = ok && counters.dropped_newest > 0 && counters.dropped_oldest == 0;
+  else
+    ok = ok && counters.dropped_newest == 0 && counters.dropped_oldest > 0 && sequences.back() == num_packets;
+
+  std::cout << "[BackpressureCheck] " << name << ": " << sequences.size() << " processed, "
+            << counters.dropped_oldest << " dropped oldest, " << counters.dropped_newest << " dropped newest, "
+            << statistics.dropped_busy << " dropped busy by the parser" << (ok ? "" : " FAILED") << std::endl;
+
+  return ok;
+}
+
+int main()
+{
+  bool ok = check(libfreenect2::BackpressurePolicy::DropOldest, "DropOldest");
+  ok = check(libfreenect2::BackpressurePolicy::DropNewest, "DropNewest") && ok;
+  ok = check(libfreenect2::BackpressurePolicy::Coalesce, "Coalesce") && ok;
+
+  return ok ? 0 : 1;
+}
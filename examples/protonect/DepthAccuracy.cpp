@@ -0,0 +1,517 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+
+/**
+ * Compares the depth and ir images of the CpuDepthPacketProcessor with a straightforward reference, which evaluates
+ * the original formulas per pixel and looks up the phase shifted cos/sin values in full per pixel tables.
+ * Both run without the bilateral and the edge aware filter on random and synthetic packets with random P0 tables.
+ * Rounding differences are amplified at pixels whose amplitude is close to the threshold, so the depth difference
+ * grows with the depth. On pixels valid in both images the run fails if the difference relative to the reference
+ * depth exceeds bound on any pixel, or if more than one in 100000 pixels differ by more than bound_mm. Over 512
+ * frames at most 0.0074 of the depth (53mm) and 18 of 19.3 million pixels above 0.1mm were measured, so the
+ * defaults are 0.008 and 0.1mm. With fastmath the fast math mode of the processor is compared with its exact mode
+ * instead.
+ *
+ * This is a manual check, it is not run by the build.
+ *
+ * Usage: DepthAccuracy [frames <n>] [bound <relative difference>] [bound_mm <difference in mm>] [fastmath]
+ * The 11to16.bin, xTable.bin and zTable.bin files are read from the working directory.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <cmath>
+
+#if defined(WIN32)
+#define _USE_MATH_DEFINES
+#include <math.h>
+#endif
+
+#include <libfreenect2/depth_packet_processor.h>
+#include <libfreenect2/protocol/response.h>
+
+static const int width = 512, height = 424;
+
+static bool loadTable(const char *filename, void *buffer, size_t n)
+{
+  std::ifstream in(filename, std::ios::binary);
+  in.read(reinterpret_cast<char*>(buffer), n);
+
+  if((size_t)in.gcount() != n)
+  {
+    std::cerr << "[DepthAccuracy] Loading '" << filename << "' failed!" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+static int bfi(int width, int offset, int src2, int src3)
+{
+  int bitmask = (((1 << width)-1) << offset) & 0xffffffff;
+  return ((src2 << offset) & bitmask) | (src3 & ~bitmask);
+}
+
+/**
+ * The per pixel formulas of the CpuDepthPacketProcessor before it was optimized, without the filters.
+ */
+class ReferenceDepthProcessor
+{
+public:
+  libfreenect2::DepthPacketProcessor::Parameters params;
+
+  int16_t lut11to16[2048];
+  std::vector<float> x_table, z_table;
+  // cos(p0 + phase) and sin(-(p0 + phase)) of the three phases per pixel and frequency
+  std::vector<float> trig_table[3];
+
+  ReferenceDepthProcessor() :
+    x_table(width * height),
+    z_table(width * height)
+  {
+    for(int i = 0; i < 3; ++i)
+      trig_table[i].resize(width * height * 6);
+  }
+
+  bool loadTables()
+  {
+    return loadTable("11to16.bin", lut11to16, sizeof(lut11to16)) &&
+        loadTable("xTable.bin", &x_table[0], x_table.size() * sizeof(float)) &&
+        loadTable("zTable.bin", &z_table[0], z_table.size() * sizeof(float));
+  }
+
+  static uint16_t p0Value(const libfreenect2::protocol::P0TablesResponse &p0_tables, int table, int i)
+  {
+    // the response is packed, so the tables can not be accessed through pointers
+    switch(table)
+    {
+      case 0: return p0_tables.p0table0[i];
+      case 1: return p0_tables.p0table1[i];
+      default: return p0_tables.p0table2[i];
+    }
+  }
+
+  void loadP0Tables(const libfreenect2::protocol::P0TablesResponse &p0_tables)
+  {
+    for(int t = 0; t < 3; ++t)
+    {
+      for(int y = 0; y < height; ++y)
+      {
+        for(int x = 0; x < width; ++x)
+        {
+          // the tables are stored upside down
+          float p0 = -((float)p0Value(p0_tables, t, (height - 1 - y) * width + x)) * 0.000031 * M_PI;
+          float *trig = &trig_table[t][(y * width + x) * 6];
+
+          for(int i = 0; i < 3; ++i)
+          {
+            float tmp = p0 + params.phase_in_rad[i];
+            trig[i] = std::cos(tmp);
+            trig[i + 3] = std::sin(-tmp);
+          }
+        }
+      }
+    }
+  }
+
+  int32_t decodePixelMeasurement(const unsigned char *data, int sub, int x, int y)
+  {
+    // 298496 = 512 * 424 * 11 / 8 = number of bytes per sub image
+    const uint16_t *ptr = reinterpret_cast<const uint16_t *>(data + 298496 * sub);
+    int i = y < 212 ? y + 212 : 423 - y;
+    ptr += 352*i;
+
+    bool r1y = x < 1 || y < 0 || 510 < x || 423 < y;
+    int r1yi = r1y ? 0x1fffffff : 0x0;
+
+    int r1zi = bfi(2, 7, x, 0) + (x >> 2);
+    r1zi = (r1zi * 11L) & 0xffffffff;
+    r1yi = r1yi + (r1zi >> 4);
+    r1zi = r1zi & 15;
+    int r4wi = -r1zi + 16;
+
+    if(r1yi > 352)
+    {
+      return lut11to16[0];
+    }
+
+    int i1 = ptr[r1yi] >> r1zi;
+    int i2 = ptr[r1yi + 1] << r4wi;
+
+    return lut11to16[((i1 | i2) & 2047)];
+  }
+
+  void processMeasurementTriple(int table, int x, int y, const int32_t *m, float *m_out)
+  {
+    const float *trig = &trig_table[table][(y * width + x) * 6];
+
+    float zmultiplier = z_table[y * width + x];
+    bool cond0 = 0 < zmultiplier;
+    bool cond1 = (m[0] == 32767 || m[1] == 32767 || m[2] == 32767) && cond0;
+
+    float tmp3 = trig[0] * m[0] + trig[1] * m[1] + trig[2] * m[2];
+    float tmp4 = trig[3] * m[0] + trig[4] * m[1] + trig[5] * m[2];
+
+    tmp3 *= params.ab_multiplier_per_frq[table];
+    tmp4 *= params.ab_multiplier_per_frq[table];
+    float tmp5 = std::sqrt(tmp3 * tmp3 + tmp4 * tmp4) * params.ab_multiplier;
+
+    tmp3 = cond0 ? tmp3 : 0;
+    tmp4 = cond0 ? tmp4 : 0;
+    tmp5 = cond0 ? tmp5 : 0;
+
+    m_out[0] = !cond1 ? tmp3 : 0;
+    m_out[1] = !cond1 ? tmp4 : 0;
+    m_out[2] = !cond1 ? tmp5 : 65535.0;
+  }
+
+  void transformMeasurements(float *m)
+  {
+    float tmp0 = std::atan2((m[1]), (m[0]));
+    tmp0 = tmp0 < 0 ? tmp0 + M_PI * 2.0f : tmp0;
+    tmp0 = (tmp0 != tmp0) ? 0 : tmp0;
+
+    float tmp1 = std::sqrt(m[0] * m[0] + m[1] * m[1]) * params.ab_multiplier;
+
+    m[0] = tmp0;
+    m[1] = tmp1;
+  }
+
+  float phaseToDepth(int x, int y, float *m0, float *m1, float *m2)
+  {
+    float ir_sum = m0[1] + m1[1] + m2[1];
+    float ir_min = std::min(std::min(m0[1], m1[1]), m2[1]);
+    float phase = 0;
+
+    if(ir_min >= params.individual_ab_threshold && ir_sum >= params.ab_threshold)
+    {
+      float t0 = m0[0] / (2.0f * M_PI) * 3.0f;
+      float t1 = m1[0] / (2.0f * M_PI) * 15.0f;
+      float t2 = m2[0] / (2.0f * M_PI) * 2.0f;
+
+      float t5 = (std::floor((t1 - t0) * 0.333333f + 0.5f) * 3.0f + t0);
+      float t3 = (-t2 + t5);
+      float t4 = t3 * 2.0f;
+
+      bool c1 = t4 >= -t4;
+
+      float f1 = c1 ? 2.0f : -2.0f;
+      float f2 = c1 ? 0.5f : -0.5f;
+      t3 *= f2;
+      t3 = (t3 - std::floor(t3)) * f1;
+
+      bool c2 = 0.5f < std::abs(t3) && std::abs(t3) < 1.5f;
+
+      float t6 = c2 ? t5 + 15.0f : t5;
+      float t7 = c2 ? t1 + 15.0f : t1;
+
+      float t8 = (std::floor((-t2 + t6) * 0.5f + 0.5f) * 2.0f + t2) * 0.5f;
+
+      t6 *= 0.333333f;
+      t7 *= 0.066667f;
+
+      float t9 = (t8 + t6 + t7);
+      float t10 = t9 * 0.333333f;
+
+      t6 *= 2.0f * M_PI;
+      t7 *= 2.0f * M_PI;
+      t8 *= 2.0f * M_PI;
+
+      float t8_new = t7 * 0.826977f - t8 * 0.110264f;
+      float t6_new = t8 * 0.551318f - t6 * 0.826977f;
+      float t7_new = t6 * 0.110264f - t7 * 0.551318f;
+
+      float norm = t8_new * t8_new + t6_new * t6_new + t7_new * t7_new;
+      t10 *= t9 >= 0.0f ? 1.0f : 0.0f;
+
+      float ir_x = 0 < params.ab_confidence_slope ? ir_min : std::max(std::max(m0[1], m1[1]), m2[1]);
+
+      ir_x = std::log(ir_x);
+      ir_x = (ir_x * params.ab_confidence_slope * 0.301030f + params.ab_confidence_offset) * 3.321928f;
+      ir_x = std::exp(ir_x);
+      ir_x = std::min(params.max_dealias_confidence, std::max(params.min_dealias_confidence, ir_x));
+      ir_x *= ir_x;
+
+      phase = ir_x >= norm ? t10 : 0.0f;
+    }
+
+    float zmultiplier = z_table[y * width + x];
+    float xmultiplier = x_table[y * width + x];
+
+    phase = 0 < phase ? phase + params.phase_offset : phase;
+
+    float depth_linear = zmultiplier * phase;
+    float max_depth = phase * params.unambigious_dist * 2;
+
+    bool cond1 = 0 < depth_linear && 0 < max_depth;
+
+    xmultiplier = (xmultiplier * 90) / (max_depth * max_depth * 8192.0);
+
+    float depth_fit = depth_linear / (-depth_linear * xmultiplier + 1);
+    depth_fit = depth_fit < 0 ? 0 : depth_fit;
+
+    return cond1 ? depth_fit : depth_linear;
+  }
+
+  /** images have the same orientation as the frames of the CpuDepthPacketProcessor */
+  void process(const unsigned char *data, float *ir_out, float *depth_out)
+  {
+    for(int y = 0; y < height; ++y)
+    {
+      for(int x = 0; x < width; ++x)
+      {
+        float m[3][3];
+
+        for(int t = 0; t < 3; ++t)
+        {
+          int32_t raw[3];
+
+          for(int i = 0; i < 3; ++i)
+            raw[i] = decodePixelMeasurement(data, t * 3 + i, x, y);
+
+          processMeasurementTriple(t, x, y, raw, m[t]);
+        }
+
+        float ir = std::min((m[0][2] + m[1][2] + m[2][2]) * 0.3333333f * params.ab_output_multiplier, 65535.0f);
+
+        transformMeasurements(m[0]);
+        transformMeasurements(m[1]);
+        transformMeasurements(m[2]);
+
+        size_t offset = (height - 1 - y) * width + x;
+        ir_out[offset] = ir;
+        depth_out[offset] = phaseToDepth(x, y, m[0], m[1], m[2]);
+      }
+    }
+  }
+};
+
+class FrameCollector : public libfreenect2::FrameListener
+{
+public:
+  libfreenect2::Frame *ir, *depth;
+
+  FrameCollector() : ir(0), depth(0)
+  {
+  }
+
+  virtual ~FrameCollector()
+  {
+    clear();
+  }
+
+  void clear()
+  {
+    delete ir;
+    delete depth;
+    ir = depth = 0;
+  }
+
+  virtual bool onNewFrame(libfreenect2::Frame::Type type, libfreenect2::Frame *frame)
+  {
+    if(type == libfreenect2::Frame::Ir)
+      ir = frame;
+    else if(type == libfreenect2::Frame::Depth)
+      depth = frame;
+    else
+      return false;
+
+    return true;
+  }
+};
+
+int main(int argc, char *argv[])
+{
+  int num_frames = 16;
+  double bound = 0.008;
+  double bound_mm = 0.1;
+  bool fast_math = false;
+
+  for(int argI = 1; argI < argc; ++argI)
+  {
+    const std::string arg(argv[argI]);
+
+    if(arg == "frames" && argI + 1 < argc)
+    {
+      num_frames = std::atoi(argv[++argI]);
+    }
+    else if(arg == "bound" && argI + 1 < argc)
+    {
+      bound = std::atof(argv[++argI]);
+    }
+    else if(arg == "bound_mm" && argI + 1 < argc)
+    {
+      bound_mm = std::atof(argv[++argI]);
+    }
+    else if(arg == "fastmath")
+    {
+      fast_math = true;
+    }
+    else
+    {
+      std::cout << "Unknown argument: " << arg << std::endl;
+      return -1;
+    }
+  }
+
+  ReferenceDepthProcessor reference;
+
+  if(!reference.loadTables())
+    return -1;
+
+  libfreenect2::DepthPacketProcessor::Config config;
+  config.EnableBilateralFilter = false;
+  config.EnableEdgeAwareFilter = false;
+
+  FrameCollector collector, exact_collector;
+  libfreenect2::CpuDepthPacketProcessor processor, exact_processor;
+  libfreenect2::CpuDepthPacketProcessor *processors[2] = { &processor, &exact_processor };
+  FrameCollector *collectors[2] = { &collector, &exact_collector };
+
+  for(int i = 0; i < 2; ++i)
+  {
+    processors[i]->setConfiguration(config);
+    processors[i]->setFrameListener(collectors[i]);
+    processors[i]->load11To16LutFromFile("11to16.bin");
+    processors[i]->loadXTableFromFile("xTable.bin");
+    processors[i]->loadZTableFromFile("zTable.bin");
+  }
+
+  // the fast math mode is compared with the exact mode of the processor instead of the reference
+  processor.setFastMath(fast_math);
+
+  std::vector<unsigned char> p0_buffer(sizeof(libfreenect2::protocol::P0TablesResponse));
+  libfreenect2::protocol::P0TablesResponse &p0 = *reinterpret_cast<libfreenect2::protocol::P0TablesResponse*>(&p0_buffer[0]);
+
+  // 10 sub images of 352 * 424 11 bit values
+  std::vector<unsigned char> packet(352 * 424 * 10 * 2);
+  std::vector<float> ir(width * height), depth(width * height);
+
+  double max_depth_diff = 0, max_relative_diff = 0, max_ir_diff = 0;
+  size_t depth_diffs = 0, large_depth_diffs = 0, validity_changes = 0, valid_pixels = 0;
+
+  std::srand(42);
+
+  for(int frame = 0; frame < num_frames; ++frame)
+  {
+    for(int i = 0; i < width * height; ++i)
+    {
+      p0.p0table0[i] = std::rand() & 0xffff;
+      p0.p0table1[i] = std::rand() & 0xffff;
+      p0.p0table2[i] = std::rand() & 0xffff;
+    }
+
+    // alternate between noise and smooth data, which makes most pixels valid
+    for(size_t i = 0; i < packet.size(); ++i)
+      packet[i] = (frame & 1) == 0 ? std::rand() & 0xff : (unsigned char)(((i + frame) / 7) ^ (i >> 9));
+
+    processor.loadP0TablesFromCommandResponse(&p0_buffer[0], p0_buffer.size());
+
+    if(!fast_math)
+      reference.loadP0Tables(p0);
+
+    libfreenect2::DepthPacket depth_packet;
+    depth_packet.sequence = frame;
+    depth_packet.timestamp = frame;
+    depth_packet.buffer = &packet[0];
+    depth_packet.buffer_length = packet.size();
+
+    collector.clear();
+    processor.process(depth_packet);
+
+    if(fast_math)
+    {
+      exact_collector.clear();
+      exact_processor.loadP0TablesFromCommandResponse(&p0_buffer[0], p0_buffer.size());
+      exact_processor.process(depth_packet);
+
+      if(exact_collector.ir != 0 && exact_collector.depth != 0)
+      {
+        std::copy(exact_collector.ir->data, exact_collector.ir->data + ir.size() * sizeof(float), reinterpret_cast<unsigned char*>(&ir[0]));
+        std::copy(exact_collector.depth->data, exact_collector.depth->data + depth.size() * sizeof(float), reinterpret_cast<unsigned char*>(&depth[0]));
+      }
+    }
+    else
+    {
+      reference.process(&packet[0], &ir[0], &depth[0]);
+    }
+
+    if(collector.ir == 0 || collector.depth == 0 || (fast_math && (exact_collector.ir == 0 || exact_collector.depth == 0)))
+    {
+      std::cerr << "[DepthAccuracy] the processor did not deliver both frames!" << std::endl;
+      return -1;
+    }
+
+    const float *processor_ir = reinterpret_cast<const float*>(collector.ir->data);
+    const float *processor_depth = reinterpret_cast<const float*>(collector.depth->data);
+
+    for(int i = 0; i < width * height; ++i)
+    {
+      max_ir_diff = std::max<double>(max_ir_diff, std::abs(processor_ir[i] - ir[i]));
+
+      if((processor_depth[i] > 0) != (depth[i] > 0))
+      {
+        ++validity_changes;
+      }
+      else if(depth[i] > 0)
+      {
+        double diff = std::abs(processor_depth[i] - depth[i]);
+        max_depth_diff = std::max(max_depth_diff, diff);
+        max_relative_diff = std::max(max_relative_diff, diff / depth[i]);
+        depth_diffs += diff > 0;
+        large_depth_diffs += diff > bound_mm;
+        ++valid_pixels;
+      }
+    }
+  }
+
+  std::cout << "[DepthAccuracy] " << num_frames << " frames, " << valid_pixels << " pixels valid in both: "
+            << depth_diffs << " differ, " << large_depth_diffs << " by more than " << bound_mm << "mm, at most " << max_depth_diff << "mm or "
+            << max_relative_diff << " of the depth, " << validity_changes << " changed validity, ir differs by at most "
+            << max_ir_diff << std::endl;
+
+  bool ok = true;
+
+  if(max_relative_diff > bound)
+  {
+    std::cerr << "[DepthAccuracy] depth differs by more than " << bound << " of the reference depth!" << std::endl;
+    ok = false;
+  }
+
+  // only a few pixels close to the amplitude threshold may differ by more than the absolute bound
+  if(large_depth_diffs * 100000 > valid_pixels)
+  {
+    std::cerr << "[DepthAccuracy] more than one in 100000 pixels differs by more than " << bound_mm << "mm!" << std::endl;
+    ok = false;
+  }
+
+  return ok ? 0 : 1;
+}
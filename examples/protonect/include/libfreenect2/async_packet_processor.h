@@ -27,63 +27,205 @@
 #ifndef ASYNC_PACKET_PROCESSOR_H_
 #define ASYNC_PACKET_PROCESSOR_H_
 
+#include <vector>
+
 #include <libfreenect2/threading.h>
 #include <libfreenect2/packet_processor.h>
+#include <libfreenect2/packet_buffer_ring.h>
+#include <libfreenect2/packet_handoff.h>
+#include <libfreenect2/frame_trace.h>
+#include <libfreenect2/backpressure.h>
 
 namespace libfreenect2
 {
 
+/**
+ * Runs the wrapped processor in a background thread. Up to queue_size packets
+ * (at least 1) are buffered while the processor is busy, so short processing
+ * hiccups do not drop packets. The packet memory is retained until the packet
+ * was processed. The stream parser therefore needs queue_size + 3 buffers in
+ * its PacketBufferRing: the queued packets, the one being processed, the one
+ * being assembled and a free one for the next packet, which the DropOldest and
+ * Coalesce policies accept while the queue is full.
+ *
+ * ready() and process() are called from the USB thread. The queue is a single
+ * producer/single consumer ring of slot indices, the worker claims the oldest
+ * entry with a compare exchange of the head index and the producer does the
+ * same to drop it. The worker is woken through a WakeupEvent if it is
+ * sleeping. Except for the Block policy, which waits in ready() until the
+ * worker claimed a packet and woke it through a second WakeupEvent, the
+ * producer never waits for the processing.
+ */
 template<typename PacketT>
-class AsyncPacketProcessor : public PacketProcessor<PacketT>
+class AsyncPacketProcessor : public PacketProcessor<PacketT>, public BackpressureControl
 {
 public:
   typedef PacketProcessor<PacketT>* PacketProcessorPtr;
 
-  AsyncPacketProcessor(PacketProcessorPtr processor) :
+  AsyncPacketProcessor(PacketProcessorPtr processor, size_t queue_size = 1) :
     processor_(processor),
-    current_packet_available_(false),
-    shutdown_(false),
+    capacity_(queue_size > 0 ? queue_size : 1),
+    packets_(capacity_ + 1),
+    enqueue_time_(capacity_ + 1),
+    slot_used_(new libfreenect2::atomic_size_t[capacity_ + 1]),
+    queue_(new libfreenect2::atomic_size_t[capacity_]),
+    head_(0),
+    tail_(0),
+    waiting_(0),
+    shutdown_(0),
+    producer_waiting_(0),
+    accepted_(0),
+    dropped_newest_(0),
+    dropped_oldest_(0),
+    blocked_(0),
+    timed_out_(0),
     thread_(&AsyncPacketProcessor<PacketT>::static_execute, this)
   {
+    // std::atomic is not initialized by its default constructor
+    for(size_t i = 0; i <= capacity_; ++i)
+      slot_used_[i].store(0);
   }
   virtual ~AsyncPacketProcessor()
   {
-    shutdown_ = true;
-    packet_condition_.notify_one();
+    shutdown_.store(1);
+    wakeup_.notify();
 
     thread_.join();
+
+    // give back the memory of all packets, which were not processed
+    for(size_t i = head_.load(); i != tail_.load(); ++i)
+    {
+      releaseMemory(packets_[queue_[i % capacity_].load()]);
+    }
+
+    delete[] queue_;
+    delete[] slot_used_;
   }
 
   virtual bool ready()
   {
-    // try to aquire lock, if we succeed the background thread is waiting on packet_condition_
-    bool locked = packet_mutex_.try_lock();
+    if(hasRoom())
+      return true;
 
-    if(locked)
+    switch(policy_.type)
     {
-      packet_mutex_.unlock();
+    case BackpressurePolicy::DropOldest:
+    case BackpressurePolicy::Coalesce:
+      // process() makes room
+      return true;
+
+    case BackpressurePolicy::Block:
+      increment(blocked_);
+
+      if(!waitForRoom(policy_.timeout))
+      {
+        increment(timed_out_);
+        increment(dropped_newest_);
+        return false;
+      }
+      return true;
+
+    default:
+      increment(dropped_newest_);
+      return false;
     }
+  }
 
-    return locked;
+  /** the worker gathers each packet, so the wrapped processor always gets it in one piece */
+  virtual bool gathersLentMemory() const
+  {
+    return true;
   }
 
   virtual void process(const PacketT &packet)
   {
+    if(policy_.type == BackpressurePolicy::Coalesce)
     {
-      libfreenect2::lock_guard l(packet_mutex_);
-      current_packet_ = packet;
-      current_packet_available_ = true;
+      while(dropOldest());
     }
-    packet_condition_.notify_one();
+    else if(policy_.type == BackpressurePolicy::DropOldest && !hasRoom())
+    {
+      dropOldest();
+    }
+
+    if(!hasRoom())
+    {
+      increment(dropped_newest_);
+      return;
+    }
+
+    // with room in the queue at most capacity_ slots are queued or processed, so one is free
+    size_t slot = 0;
+    while(slot_used_[slot].load() != 0) ++slot;
+
+    if(packet.memory != 0)
+      packet.memory->retain();
+
+    packets_[slot] = packet;
+    enqueue_time_[slot] = FrameTrace::now();
+    slot_used_[slot].store(1);
+
+    // publish the packet, then wake the worker if it went to sleep on an empty queue
+    size_t tail = tail_.load();
+    queue_[tail % capacity_].store(slot);
+    tail_.store(tail + 1);
+    increment(accepted_);
+
+    if(waiting_.load() != 0)
+      wakeup_.notify();
+  }
+
+  /** statistics of the time between process() and the start of the processing */
+  HandoffStatistics handoffStatistics()
+  {
+    libfreenect2::lock_guard l(statistics_mutex_);
+    return statistics_;
+  }
+
+  /** has to be set before packets arrive */
+  virtual void setBackpressurePolicy(const BackpressurePolicy &policy)
+  {
+    policy_ = policy;
+  }
+
+  virtual BackpressureCounters backpressureCounters() const
+  {
+    BackpressureCounters counters;
+    counters.accepted = accepted_.load();
+    counters.dropped_newest = dropped_newest_.load();
+    counters.dropped_oldest = dropped_oldest_.load();
+    counters.blocked = blocked_.load();
+    counters.timed_out = timed_out_.load();
+    return counters;
   }
 private:
   PacketProcessorPtr processor_;
-  bool current_packet_available_;
-  PacketT current_packet_;
+  BackpressurePolicy policy_;
+
+  // packets_ has one slot more than the queue for the packet being processed
+  // queue_ holds the slot indices in arrival order, head_ is advanced by whoever
+  // claims the oldest entry, tail_ only by the producer
+  size_t capacity_;
+  std::vector<PacketT> packets_;
+  std::vector<double> enqueue_time_;
+  libfreenect2::atomic_size_t *slot_used_;
+  libfreenect2::atomic_size_t *queue_;
+  libfreenect2::atomic_size_t head_, tail_;
+
+  libfreenect2::atomic_size_t waiting_;
+  libfreenect2::atomic_size_t shutdown_;
+  WakeupEvent wakeup_;
+
+  // the producer waits for room with the Block policy, the worker wakes it after claiming a packet
+  libfreenect2::atomic_size_t producer_waiting_;
+  WakeupEvent room_;
+
+  libfreenect2::mutex statistics_mutex_;
+  HandoffStatistics statistics_;
+
+  // only written by the producer
+  libfreenect2::atomic_size_t accepted_, dropped_newest_, dropped_oldest_, blocked_, timed_out_;
 
-  bool shutdown_;
-  libfreenect2::mutex packet_mutex_;
-  libfreenect2::condition_variable packet_condition_;
   libfreenect2::thread thread_;
 
   static void static_execute(void *data)
@@ -91,21 +233,125 @@ private:
     static_cast<AsyncPacketProcessor<PacketT> *>(data)->execute();
   }
 
-  void execute()
+  static void increment(libfreenect2::atomic_size_t &counter)
+  {
+    counter.store(counter.load() + 1);
+  }
+
+  static void gatherMemory(const PacketT &packet)
+  {
+    if(packet.memory != 0)
+      packet.memory->gather();
+  }
+
+  static void releaseMemory(const PacketT &packet)
+  {
+    if(packet.memory != 0)
+      packet.memory->release();
+  }
+
+  bool hasRoom() const
+  {
+    return tail_.load() - head_.load() < capacity_;
+  }
+
+  /** claims the oldest queued packet, fails if the queue is empty */
+  bool claim(size_t &slot)
+  {
+    size_t head = head_.load();
+
+    while(head != tail_.load())
+    {
+      slot = queue_[head % capacity_].load();
+
+      // on failure the other side claimed it and head is reloaded
+      if(head_.compare_exchange_strong(head, head + 1))
+        return true;
+    }
+
+    return false;
+  }
+
+  bool waitForRoom(double timeout)
   {
-    libfreenect2::unique_lock l(packet_mutex_);
+    double deadline = FrameTrace::now() + timeout;
+    bool room;
+
+    room_.reset();
 
-    while(!shutdown_)
+    while(true)
     {
-      WAIT_CONDITION(packet_condition_, packet_mutex_, l);
+      // announce the wait before checking the queue, so the worker can not miss it
+      producer_waiting_.store(1);
+
+      room = hasRoom();
+      double remaining = deadline - FrameTrace::now();
+
+      if(room || remaining <= 0.0 || !room_.waitFor(remaining))
+        break;
+    }
+
+    producer_waiting_.store(0);
+
+    // the queue may have gotten room just at the deadline
+    return room || hasRoom();
+  }
 
-      if(current_packet_available_)
+  bool dropOldest()
+  {
+    size_t slot;
+
+    if(!claim(slot))
+      return false;
+
+    releaseMemory(packets_[slot]);
+    slot_used_[slot].store(0);
+    increment(dropped_oldest_);
+    return true;
+  }
+
+  bool next(size_t &slot)
+  {
+    while(shutdown_.load() == 0)
+    {
+      if(claim(slot))
       {
-        // invoke process impl
-        processor_->process(current_packet_);
+        if(producer_waiting_.load() != 0)
+          room_.notify();
+
+        double latency = FrameTrace::now() - enqueue_time_[slot];
+
+        libfreenect2::lock_guard l(statistics_mutex_);
+        statistics_.add(latency);
+        return true;
+      }
+
+      // announce the sleep before checking the queue again, so the producer can not miss it
+      waiting_.store(1);
 
-        current_packet_available_ = false;
+      if(tail_.load() == head_.load() && shutdown_.load() == 0)
+      {
+        wakeup_.wait();
       }
+
+      waiting_.store(0);
+    }
+
+    return false;
+  }
+
+  void execute()
+  {
+    size_t slot;
+
+    while(next(slot))
+    {
+      gatherMemory(packets_[slot]);
+      processor_->process(packets_[slot]);
+
+      // give back the memory before freeing the slot, so the parser finds a free buffer when the queue has room
+      releaseMemory(packets_[slot]);
+      slot_used_[slot].store(0);
     }
   }
 };
@@ -0,0 +1,83 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#ifndef BACKPRESSURE_H_
+#define BACKPRESSURE_H_
+
+#include <stddef.h>
+
+#include <libfreenect2/config.h>
+
+namespace libfreenect2
+{
+
+/** what a queue does with a new packet or frame while it is full */
+struct LIBFREENECT2_API BackpressurePolicy
+{
+  enum Type
+  {
+    DropNewest, ///< discard the new element, favors completeness of what is already queued
+    DropOldest, ///< discard the oldest queued element to make room
+    Block,      ///< wait up to timeout seconds for room, then discard the new element
+    Coalesce    ///< discard everything queued before the new element, favors latency
+  };
+
+  Type type;
+  double timeout;
+
+  BackpressurePolicy(Type type = DropNewest, double timeout = 0.0);
+};
+
+/** what a queue did with the elements offered to it */
+struct LIBFREENECT2_API BackpressureCounters
+{
+  size_t accepted;
+  // new elements discarded, because the queue was full or a Block wait timed out,
+  // the stream parsers do not count them again
+  size_t dropped_newest;
+  // queued elements discarded in favor of newer ones by DropOldest and Coalesce
+  size_t dropped_oldest;
+  // new elements which had to wait for room and of those the ones which gave up
+  size_t blocked;
+  size_t timed_out;
+
+  BackpressureCounters();
+
+  BackpressureCounters &operator+=(const BackpressureCounters &other);
+};
+
+/** implemented by the queues between the stream stages */
+class LIBFREENECT2_API BackpressureControl
+{
+public:
+  virtual ~BackpressureControl();
+
+  virtual void setBackpressurePolicy(const BackpressurePolicy &policy) = 0;
+  virtual BackpressureCounters backpressureCounters() const = 0;
+};
+
+} /* namespace libfreenect2 */
+#endif /* BACKPRESSURE_H_ */
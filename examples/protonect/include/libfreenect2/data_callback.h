@@ -34,10 +34,31 @@
 namespace libfreenect2
 {
 
+/** handle to memory lent by a data source, see DataCallback::onDataLent() */
+class LIBFREENECT2_API DataReference
+{
+public:
+  virtual ~DataReference() {}
+
+  /** gives the memory back to its source, can be called from any thread */
+  virtual void release() = 0;
+};
+
 class LIBFREENECT2_API DataCallback
 {
 public:
   virtual void onDataReceived(unsigned char *buffer, size_t n) = 0;
+
+  /**
+   * Called instead of onDataReceived() by sources which can lend their memory.
+   * Returning true keeps the buffer valid until reference->release() is called,
+   * the default copies the data through onDataReceived().
+   */
+  virtual bool onDataLent(unsigned char *buffer, size_t n, DataReference * /*reference*/)
+  {
+    onDataReceived(buffer, n);
+    return false;
+  }
 };
 
 } // namespace libfreenect2
@@ -37,12 +37,25 @@
 namespace libfreenect2
 {
 
+struct PacketBuffer;
+
 struct LIBFREENECT2_API DepthPacket
 {
+  DepthPacket() : valid_sub_images(0x3ff), memory(0) {}
+
   uint32_t sequence;
   uint32_t timestamp;
   unsigned char *buffer;
   size_t buffer_length;
+
+  // bit i is set if sub image i was received, missing sub images are filled with zeros
+  uint32_t valid_sub_images;
+
+  // transfer and parser stages, processors copy it to their frames
+  FrameTrace trace;
+
+  // buffer backing the packet data, processors deferring the processing have to retain it
+  PacketBuffer *memory;
 };
 
 typedef PacketProcessor<DepthPacket> BaseDepthPacketProcessor;
@@ -57,6 +70,12 @@ public:
     
     bool EnableBilateralFilter;
     bool EnableEdgeAwareFilter;
+
+    // number of threads used by the CpuDepthPacketProcessor, 1 processes the whole image on the calling thread
+    unsigned int NumThreads;
+
+    // CpuDepthPacketProcessor runs all stages row by row on small per thread buffers instead of full frame intermediates
+    bool EnableFusedPipeline;
     
     Config();
   };
@@ -150,6 +169,17 @@ public:
   virtual ~CpuDepthPacketProcessor();
   virtual void setConfiguration(const libfreenect2::DepthPacketProcessor::Config &config);
 
+  /**
+   * Replaces atan2, log, exp and floor in stage 2 by branch free scalar approximations, disabled by default.
+   * Only atan2 changes the depth value: its error of at most 2.7e-7 rad moves the averaged phase by at most
+   * 2.7e-7 / (2 pi) = 4.3e-8 phase units. Above a linear depth of 35mm the depth fit rises by less than
+   * max(zTable) = 2083.3mm per phase unit, which bounds the difference to 9e-5mm plus a few ulp of float rounding
+   * of the stage 2 intermediates. log and exp only enter the dealiasing confidence, so pixels whose confidence or
+   * unwrapping is within the error of a threshold can change their validity or their unwrapped phase.
+   * DepthAccuracy fastmath measures the difference to the exact mode.
+   */
+  void setFastMath(bool enabled);
+
   virtual void loadP0TablesFromCommandResponse(unsigned char* buffer, size_t buffer_length);
 
   void loadP0TablesFromFiles(const char* p0_filename, const char* p1_filename, const char* p2_filename);
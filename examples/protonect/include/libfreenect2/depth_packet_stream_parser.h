@@ -32,7 +32,9 @@
 
 #include <libfreenect2/config.h>
 
-#include <libfreenect2/double_buffer.h>
+#include <libfreenect2/packet_buffer_ring.h>
+#include <libfreenect2/stream_statistics.h>
+#include <libfreenect2/threading.h>
 #include <libfreenect2/depth_packet_processor.h>
 
 #include <libfreenect2/data_callback.h>
@@ -54,20 +56,60 @@ LIBFREENECT2_PACK(struct LIBFREENECT2_API DepthSubPacketFooter
 class LIBFREENECT2_API DepthPacketStreamParser : public DataCallback
 {
 public:
-  DepthPacketStreamParser();
+  /** num_buffers packet buffers are allocated, see AsyncPacketProcessor how many are needed */
+  DepthPacketStreamParser(size_t num_buffers = 4);
   virtual ~DepthPacketStreamParser();
 
   void setPacketProcessor(libfreenect2::BaseDepthPacketProcessor *processor);
 
+  /**
+   * Packets missing any of the sub images in mask are dropped, others are passed on with
+   * DepthPacket::valid_sub_images telling which ones are there. The default 0x1ff keeps the
+   * nine sub images the depth processors decode.
+   */
+  void setRequiredSubImages(uint32_t mask);
+
   virtual void onDataReceived(unsigned char* buffer, size_t length);
+
+  /** can be called from any thread */
+  ParserStatistics statistics() const;
 private:
+  bool isFooter(const DepthSubPacketFooter &footer, bool expected);
+  void onSubImage(const DepthSubPacketFooter &footer, unsigned char *data);
+  void finishPacket(unsigned char *&carry, uint32_t carry_subsequence);
+
   libfreenect2::BaseDepthPacketProcessor *processor_;
 
-  libfreenect2::DoubleBuffer buffer_;
-  libfreenect2::Buffer work_buffer_;
+  libfreenect2::PacketBufferRing buffer_;
+  // buffer the sub images are currently written to
+  libfreenect2::PacketBuffer *current_;
+
+  // size of one sub image, the payload of each sub image is written directly into its slot of the current buffer
+  size_t sub_image_length_;
+  // slot the current sub image is written to and number of its bytes received so far
+  uint32_t slot_;
+  size_t slot_length_;
+
+  // magic values of the first footer found at its expected position, footers are recognized by them afterwards
+  bool footer_magic_known_;
+  uint32_t footer_magic0_;
+  uint32_t footer_magic1_;
 
   uint32_t current_sequence_;
+  // bit mask of the sub images received for current_sequence_ and the timestamp of the last one
   uint32_t current_subsequence_;
+  uint32_t current_timestamp_;
+  FrameTrace current_trace_;
+  uint32_t required_sub_images_;
+
+  // counters behind statistics(), only written by the thread calling onDataReceived()
+  libfreenect2::atomic_size_t received_bytes_;
+  libfreenect2::atomic_size_t completed_frames_;
+  libfreenect2::atomic_size_t dropped_busy_;
+  libfreenect2::atomic_size_t dropped_incomplete_;
+  libfreenect2::atomic_size_t dropped_invalid_;
+  libfreenect2::atomic_size_t missing_subsequences_;
+  libfreenect2::atomic_size_t last_missing_subsequences_;
 };
 
 } /* namespace libfreenect2 */
@@ -30,10 +30,13 @@
 #include <cstddef>
 #include <stdint.h>
 #include <libfreenect2/config.h>
+#include <libfreenect2/frame_trace.h>
 
 namespace libfreenect2
 {
 
+class FramePool;
+
 struct LIBFREENECT2_API Frame
 {
   enum Type
@@ -48,18 +51,19 @@ struct LIBFREENECT2_API Frame
   size_t width, height, bytes_per_pixel;
   unsigned char* data;
 
-  Frame(size_t width, size_t height, size_t bytes_per_pixel) :
-    width(width),
-    height(height),
-    bytes_per_pixel(bytes_per_pixel)
-  {
-    data = new unsigned char[width * height * bytes_per_pixel];
-  }
+  // host times of the stages the frame passed, for latency measurements
+  FrameTrace trace;
 
-  ~Frame()
-  {
-    delete[] data;
-  }
+  Frame(size_t width, size_t height, size_t bytes_per_pixel);
+  ~Frame();
+private:
+  friend class FramePool;
+
+  // pool the data goes back to on deletion, 0 if the frame owns it
+  FramePool *pool_;
+
+  /** uses data of pool, allocates if data is 0 */
+  Frame(size_t width, size_t height, size_t bytes_per_pixel, unsigned char *data, FramePool *pool);
 };
 
 class LIBFREENECT2_API FrameListener
@@ -68,6 +72,12 @@ public:
   virtual ~FrameListener();
 
   virtual bool onNewFrame(Frame::Type type, Frame *frame) = 0;
+
+  /**
+   * Bitmask of the Frame::Type values this listener accepts. Processors skip the work for
+   * frame types not contained in it, the default accepts all types.
+   */
+  virtual unsigned int subscribedFrameTypes() const;
 };
 
 } /* namespace libfreenect2 */
@@ -27,15 +27,69 @@
 #ifndef FRAME_LISTENER_IMPL_H_
 #define FRAME_LISTENER_IMPL_H_
 
-#include <map>
-
 #include <libfreenect2/config.h>
 #include <libfreenect2/frame_listener.hpp>
+#include <libfreenect2/backpressure.h>
 
 namespace libfreenect2
 {
 
-typedef std::map<Frame::Type, Frame*> FrameMap;
+/**
+ * One frame per Frame::Type, 0 for the types not in the set. A fixed array,
+ * so handing sets around does not touch the heap.
+ */
+class LIBFREENECT2_API FrameMap
+{
+public:
+  FrameMap()
+  {
+    clear();
+  }
+
+  Frame *&operator[](Frame::Type type)
+  {
+    return frames_[index(type)];
+  }
+
+  Frame *operator[](Frame::Type type) const
+  {
+    return frames_[index(type)];
+  }
+
+  /** 1 if the set contains a frame of type, 0 otherwise */
+  size_t count(Frame::Type type) const
+  {
+    return frames_[index(type)] != 0 ? 1 : 0;
+  }
+
+  bool empty() const
+  {
+    return frames_[0] == 0 && frames_[1] == 0 && frames_[2] == 0;
+  }
+
+  /** forgets the frames without deleting them */
+  void clear()
+  {
+    frames_[0] = frames_[1] = frames_[2] = 0;
+  }
+
+  void swap(FrameMap &other)
+  {
+    for(size_t i = 0; i < 3; ++i)
+    {
+      Frame *frame = frames_[i];
+      frames_[i] = other.frames_[i];
+      other.frames_[i] = frame;
+    }
+  }
+private:
+  Frame *frames_[3];
+
+  static size_t index(Frame::Type type)
+  {
+    return type == Frame::Color ? 0 : (type == Frame::Ir ? 1 : 2);
+  }
+};
 
 class SyncMultiFrameListenerImpl;
 
@@ -56,9 +110,86 @@ public:
   void release(FrameMap &frame);
 
   virtual bool onNewFrame(Frame::Type type, Frame *frame);
+
+  virtual unsigned int subscribedFrameTypes() const;
+
+  /**
+   * Policy for a frame arriving while the previous frame of its type was not
+   * consumed yet. The default DropOldest replaces the unconsumed frame, Coalesce
+   * does the same, DropNewest keeps it and Block waits for the consumer. Block
+   * stalls the processor delivering the frame.
+   */
+  void setBackpressurePolicy(const BackpressurePolicy &policy, unsigned int frame_types = Frame::Color | Frame::Ir | Frame::Depth);
+
+  BackpressureCounters backpressureCounters(Frame::Type type) const;
+
+  /** aggregates the traces of the accepted frames per type, off by default */
+  void setLatencyHistogramEnabled(bool enabled);
+
+  LatencyHistogram latencyHistogram(Frame::Type type) const;
+
+  /**
+   * Only hands out frame sets whose timestamps differ by at most window, in
+   * units of Frame::timestamp. Up to history frames per type wait for their
+   * partners, older ones are discarded as unmatched. An unconsumed set is
+   * replaced by a newer one, the backpressure policies do not apply. A history
+   * of 0 switches back to passing on the latest frame of each type.
+   */
+  void setTimestampSync(uint32_t window, size_t history = 4);
+
+  size_t matchedFrameSets() const;
+  size_t unmatchedFrames(Frame::Type type) const;
+
+  /**
+   * Descriptor for poll, select or epoll loops, readable once a frame set is
+   * ready. Notifications are only sent after the first call, -1 if the
+   * platform has no such descriptor. Call clearNotification() before taking
+   * the set, a set getting ready later makes it readable again.
+   */
+  int getNotificationFd();
+  void clearNotification();
 private:
   SyncMultiFrameListenerImpl *impl_;
 };
 
+class LatestFrameListenerImpl;
+
+/**
+ * Keeps only the newest frame of each type in a lock free triple buffer. The
+ * producing processor never blocks and the consumer never contends with it,
+ * frames the consumer did not pick up in time are replaced. One consumer
+ * thread per frame type.
+ */
+class LIBFREENECT2_API LatestFrameListener : public FrameListener
+{
+public:
+  LatestFrameListener(unsigned int frame_types);
+  virtual ~LatestFrameListener();
+
+  /**
+   * Newest frame of type which was not returned before, 0 if there is none.
+   * The listener keeps the ownership, the frame stays valid until the next
+   * call for the same type which does not return 0.
+   */
+  Frame *latestFrame(Frame::Type type);
+
+  /** like latestFrame(), but waits for a new frame */
+  Frame *waitForLatestFrame(Frame::Type type);
+
+  /**
+   * Descriptor for poll, select or epoll loops, readable once a new frame of
+   * any type arrived, see SyncMultiFrameListener::getNotificationFd(). Call
+   * clearNotification() before taking the frames.
+   */
+  int getNotificationFd();
+  void clearNotification();
+
+  virtual bool onNewFrame(Frame::Type type, Frame *frame);
+
+  virtual unsigned int subscribedFrameTypes() const;
+private:
+  LatestFrameListenerImpl *impl_;
+};
+
 } /* namespace libfreenect2 */
 #endif /* FRAME_LISTENER_IMPL_H_ */
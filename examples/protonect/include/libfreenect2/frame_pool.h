@@ -0,0 +1,78 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+
+#ifndef FRAME_POOL_H_
+#define FRAME_POOL_H_
+
+#include <stddef.h>
+#include <vector>
+
+#include <libfreenect2/config.h>
+#include <libfreenect2/frame_listener.hpp>
+#include <libfreenect2/threading.h>
+
+namespace libfreenect2
+{
+
+/**
+ * Recycles the pixel memory of the frames of one stream. Deleting a frame
+ * created by allocate() gives its memory back to the pool, so the producer
+ * reuses it for a later frame instead of allocating and faulting in a new one.
+ * The pool stays alive until its owner called release() and all its frames
+ * were deleted, frames can outlive the processor which produced them.
+ */
+class LIBFREENECT2_API FramePool
+{
+public:
+  /** keeps up to max_idle returned buffers, more are freed */
+  FramePool(size_t width, size_t height, size_t bytes_per_pixel, size_t max_idle = 4);
+
+  Frame *allocate();
+
+  /** called by the owner instead of deleting the pool */
+  void release();
+private:
+  friend struct Frame;
+
+  size_t width_, height_, bytes_per_pixel_;
+  size_t max_idle_;
+
+  libfreenect2::mutex mutex_;
+  std::vector<unsigned char *> idle_;
+  // the owner and every frame not deleted yet
+  size_t references_;
+
+  ~FramePool();
+
+  void recycle(unsigned char *data);
+
+  FramePool(const FramePool &);
+  FramePool &operator=(const FramePool &);
+};
+
+} /* namespace libfreenect2 */
+#endif /* FRAME_POOL_H_ */
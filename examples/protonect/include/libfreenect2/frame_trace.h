@@ -0,0 +1,110 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+
+#ifndef FRAME_TRACE_H_
+#define FRAME_TRACE_H_
+
+#include <stddef.h>
+
+#include <libfreenect2/config.h>
+
+namespace libfreenect2
+{
+
+/**
+ * Host times at which the data of a frame passed the stages of the library,
+ * in seconds of a monotonic clock (see now()). Stages which were not passed
+ * or are not recorded by the pipeline are 0.
+ */
+struct LIBFREENECT2_API FrameTrace
+{
+  enum Stage
+  {
+    FirstTransfer,    ///< first usb transfer with data of the frame completed
+    LastTransfer,     ///< last usb transfer with data of the frame completed
+    ParserCommit,     ///< the parser passed the complete packet on
+    ProcessingStart,  ///< a packet processor started decoding it
+    ProcessingEnd,    ///< the frame was decoded
+    ListenerDelivery, ///< the frame was passed to the frame listener
+    NumStages
+  };
+
+  double time[NumStages];
+
+  FrameTrace();
+
+  void mark(Stage stage);
+
+  /** time from stage from to stage to, 0 if one of them was not recorded */
+  double latency(Stage from, Stage to) const;
+
+  /** the clock of the library, also timestamps the packet handoff and backpressure timeouts */
+  static double now();
+};
+
+/**
+ * Aggregates the latencies of traced frames. For every stage it counts the
+ * time since the previous recorded stage, and in total() the time from the
+ * first to the last recorded stage. Not thread safe.
+ */
+class LIBFREENECT2_API LatencyHistogram
+{
+public:
+  // bin i counts latencies below 2^i microseconds, the last one all longer ones
+  static const size_t NumBins = 24;
+
+  struct LIBFREENECT2_API Bins
+  {
+    size_t count[NumBins];
+    size_t frames;
+    double sum;
+    double max;
+
+    Bins();
+
+    double average() const;
+    /** upper bound in seconds of the bin containing fraction p of the latencies */
+    double percentile(double p) const;
+  };
+
+  void add(const FrameTrace &trace);
+  void reset();
+
+  /** latencies of reaching stage, FirstTransfer is always empty */
+  const Bins &stage(FrameTrace::Stage stage) const;
+  const Bins &total() const;
+
+  static double binUpperBound(size_t bin);
+private:
+  Bins stages_[FrameTrace::NumStages];
+  Bins total_;
+
+  static void add(Bins &bins, double latency);
+};
+
+} /* namespace libfreenect2 */
+#endif /* FRAME_TRACE_H_ */
@@ -29,6 +29,7 @@
 
 #include <libfreenect2/config.h>
 #include <libfreenect2/frame_listener.hpp>
+#include <libfreenect2/stream_statistics.h>
 
 namespace libfreenect2
 {
@@ -88,6 +89,9 @@ public:
   virtual void setColorFrameListener(libfreenect2::FrameListener* rgb_frame_listener) = 0;
   virtual void setIrAndDepthFrameListener(libfreenect2::FrameListener* ir_frame_listener) = 0;
 
+  /** snapshot of the usb and parser counters, can be called from any thread while the device is open */
+  virtual StreamStatistics getStreamStatistics() = 0;
+
   virtual void start() = 0;
   virtual void stop() = 0;
   virtual void close() = 0;
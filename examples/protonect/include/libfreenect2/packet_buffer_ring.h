@@ -0,0 +1,123 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#ifndef PACKET_BUFFER_RING_H_
+#define PACKET_BUFFER_RING_H_
+
+#include <stddef.h>
+#include <vector>
+
+#include <libfreenect2/config.h>
+#include <libfreenect2/double_buffer.h>
+#include <libfreenect2/data_callback.h>
+#include <libfreenect2/threading.h>
+
+namespace libfreenect2
+{
+
+class PacketBufferRing;
+
+/**
+ * Buffer owned by a PacketBufferRing. It goes back to the ring when the last
+ * reference is released, so a packet processor can keep the packet memory
+ * alive after process() returned by calling retain() and release() later.
+ *
+ * Parts of the packet can stay in memory lent by the data source instead of
+ * being copied to data. They are given back together with the buffer, or
+ * earlier by gather(), which copies them to their place in data.
+ */
+struct LIBFREENECT2_API PacketBuffer : public Buffer
+{
+  struct Segment
+  {
+    size_t offset;
+    unsigned char *data;
+    size_t length;
+  };
+
+  // fixed, so append() does not allocate on the thread of the data source
+  enum { MaxLent = 64 };
+
+  PacketBufferRing *ring;
+  size_t references;
+
+  // lent parts of the packet sorted by offset, all other bytes are in data
+  Segment segments[MaxLent];
+  size_t num_segments;
+  DataReference *lent[MaxLent];
+  size_t num_lent;
+
+  void retain();
+  void release();
+
+  /**
+   * appends n bytes, which are copied if reference is 0 and kept in place otherwise.
+   * If MaxLent references are kept already, the bytes are copied and reference is released.
+   */
+  void append(unsigned char *src, size_t n, DataReference *reference);
+
+  /** copies n bytes starting at offset of the packet to dst */
+  void read(size_t offset, unsigned char *dst, size_t n) const;
+
+  /** copies the lent segments to data and gives them back to their source */
+  void gather();
+
+  /** gives back the lent memory and empties the buffer */
+  void clear();
+};
+
+/**
+ * Fixed set of equally sized packet buffers handed out by acquire(). The
+ * stream parser fills the acquired buffer, passes it on with its packet and
+ * releases its own reference afterwards. The buffers can be released from any
+ * thread.
+ */
+class LIBFREENECT2_API PacketBufferRing
+{
+public:
+  PacketBufferRing();
+  /** gives back the memory still lent to the buffers */
+  virtual ~PacketBufferRing();
+
+  void allocate(size_t num_buffers, size_t buffer_size);
+
+  /** returns an unused buffer with one reference and zero length or 0 if all buffers are in use */
+  PacketBuffer *acquire();
+
+  void retain(PacketBuffer *buffer);
+  void release(PacketBuffer *buffer);
+
+  size_t size() const;
+private:
+  libfreenect2::mutex mutex_;
+  std::vector<PacketBuffer> buffer_;
+  size_t next_;
+
+  unsigned char* buffer_data_;
+};
+
+} /* namespace libfreenect2 */
+#endif /* PACKET_BUFFER_RING_H_ */
@@ -0,0 +1,87 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#ifndef PACKET_HANDOFF_H_
+#define PACKET_HANDOFF_H_
+
+#include <stddef.h>
+
+#include <libfreenect2/config.h>
+
+namespace libfreenect2
+{
+
+class WakeupEventImpl;
+
+/**
+ * Counting wakeup for a single waiting thread. On Linux notify() is a write to
+ * an eventfd and never blocks, elsewhere or if the eventfd can not be created
+ * it briefly takes the mutex of a condition variable. Callers should only
+ * notify, when the waiter announced that it is about to wait.
+ */
+class LIBFREENECT2_API WakeupEvent
+{
+public:
+  WakeupEvent();
+  virtual ~WakeupEvent();
+
+  void notify();
+
+  /** blocks until notify() was called at least once since the last wait() returned */
+  void wait();
+
+  /** like wait(), but gives up after timeout seconds and returns false then */
+  bool waitFor(double timeout);
+
+  /** forgets pending notifications without blocking */
+  void reset();
+
+  /** descriptor which is readable while a notification is pending, -1 if there is no eventfd */
+  int fileDescriptor() const;
+private:
+  WakeupEventImpl *impl_;
+
+  WakeupEvent(const WakeupEvent &);
+  WakeupEvent &operator=(const WakeupEvent &);
+};
+
+/** time packets spent in the queue between the stream parser and the processing thread */
+struct LIBFREENECT2_API HandoffStatistics
+{
+  HandoffStatistics();
+
+  size_t packets;
+  // in seconds
+  double latency_sum;
+  double latency_max;
+
+  double averageLatency() const;
+
+  void add(double latency);
+};
+
+} /* namespace libfreenect2 */
+#endif /* PACKET_HANDOFF_H_ */
@@ -33,6 +33,8 @@
 #include <libfreenect2/depth_packet_stream_parser.h>
 #include <libfreenect2/depth_packet_processor.h>
 #include <libfreenect2/rgb_packet_processor.h>
+#include <libfreenect2/backpressure.h>
+#include <libfreenect2/stream_statistics.h>
 
 namespace libfreenect2
 {
@@ -48,6 +50,14 @@ public:
 
   virtual RgbPacketProcessor *getRgbPacketProcessor() const = 0;
   virtual DepthPacketProcessor *getDepthPacketProcessor() const = 0;
+
+  /** queues between the packet parsers and the processors, 0 if the pipeline has none */
+  virtual BackpressureControl *getRgbPacketQueue() const;
+  virtual BackpressureControl *getDepthPacketQueue() const;
+
+  /** counters of the packet parsers, all zero if the pipeline does not keep any */
+  virtual ParserStatistics getRgbParserStatistics() const;
+  virtual ParserStatistics getIrParserStatistics() const;
 };
 
 class LIBFREENECT2_API BasePacketPipeline : public PacketPipeline
@@ -60,6 +70,15 @@ protected:
   BaseRgbPacketProcessor *async_rgb_processor_;
   DepthPacketProcessor *depth_processor_;
   BaseDepthPacketProcessor *async_depth_processor_;
+  BackpressureControl *rgb_packet_queue_;
+  BackpressureControl *depth_packet_queue_;
+
+  // number of depth processor instances working on consecutive packets
+  size_t num_depth_workers_;
+  // number of jpeg decoders working on consecutive color packets
+  size_t num_rgb_workers_;
+
+  BasePacketPipeline();
 
   virtual void initialize();
   virtual DepthPacketProcessor *createDepthPacketProcessor() = 0;
@@ -71,6 +90,12 @@ public:
 
   virtual RgbPacketProcessor *getRgbPacketProcessor() const;
   virtual DepthPacketProcessor *getDepthPacketProcessor() const;
+
+  virtual BackpressureControl *getRgbPacketQueue() const;
+  virtual BackpressureControl *getDepthPacketQueue() const;
+
+  virtual ParserStatistics getRgbParserStatistics() const;
+  virtual ParserStatistics getIrParserStatistics() const;
 };
 
 class LIBFREENECT2_API CpuPacketPipeline : public BasePacketPipeline
@@ -78,7 +103,11 @@ class LIBFREENECT2_API CpuPacketPipeline : public BasePacketPipeline
 protected:
   virtual DepthPacketProcessor *createDepthPacketProcessor();
 public:
-  CpuPacketPipeline();
+  /**
+   * num_depth_workers > 1 processes that many depth packets concurrently, see ParallelDepthPacketProcessor,
+   * num_rgb_workers > 1 decodes that many color packets concurrently, see ParallelRgbPacketProcessor
+   */
+  CpuPacketPipeline(size_t num_depth_workers = 1, size_t num_rgb_workers = 1);
   virtual ~CpuPacketPipeline();
 };
 
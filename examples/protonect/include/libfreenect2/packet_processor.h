@@ -38,6 +38,13 @@ public:
 
   virtual bool ready() { return true; }
   virtual void process(const PacketT &packet) = 0;
+
+  /**
+   * Whether the processor calls PacketBuffer::gather() on the packet memory
+   * before reading it. Only then the parser leaves data lent by the data
+   * source in place, otherwise it copies it and the packet is always complete.
+   */
+  virtual bool gathersLentMemory() const { return false; }
 };
 
 template<typename PacketT>
@@ -0,0 +1,253 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+#ifndef PARALLEL_PACKET_PROCESSOR_H_
+#define PARALLEL_PACKET_PROCESSOR_H_
+
+#include <vector>
+#include <deque>
+#include <utility>
+
+#include <libfreenect2/config.h>
+#include <libfreenect2/threading.h>
+#include <libfreenect2/frame_listener.hpp>
+#include <libfreenect2/async_packet_processor.h>
+#include <libfreenect2/backpressure.h>
+#include <libfreenect2/depth_packet_processor.h>
+#include <libfreenect2/rgb_packet_processor.h>
+
+namespace libfreenect2
+{
+
+/**
+ * Restores the packet order of frames produced by several workers, which
+ * receive consecutive packets round robin. Each worker delivers its frames to
+ * its own port, which takes ownership of them. Once a worker finished a
+ * packet, the frames of all packets finished in order are passed on to the
+ * real listener. Frames the listener rejects are deleted.
+ *
+ * The listener is called without holding the lock of the sequencer, by one
+ * worker at a time. The other workers only queue their frames, so a blocking
+ * listener does not stall them.
+ */
+class LIBFREENECT2_API FrameSequencer
+{
+public:
+  FrameSequencer(size_t num_workers);
+  virtual ~FrameSequencer();
+
+  /** waits for a delivery in progress, the previous listener is not called afterwards */
+  void setFrameListener(libfreenect2::FrameListener *listener);
+
+  /** listener the processor of the given worker has to deliver its frames to */
+  libfreenect2::FrameListener *port(size_t worker);
+
+  /** called by the worker after it processed a packet */
+  void complete(size_t worker);
+
+  /** the policy for the workers, they can not drop queued packets without leaving gaps */
+  static BackpressurePolicy workerPolicy(const BackpressurePolicy &policy);
+private:
+  class Port;
+  friend class Port;
+  typedef std::vector<std::pair<Frame::Type, Frame *> > FrameList;
+
+  libfreenect2::mutex mutex_;
+  libfreenect2::FrameListener *listener_;
+  std::vector<Port *> ports_;
+  std::vector<std::deque<FrameList> > completed_;
+  size_t next_worker_;
+  // a worker is passing frames to the listener, signaled when it is done
+  bool delivering_;
+  libfreenect2::condition_variable delivered_;
+  // of the listener, the ports query it for every packet
+  libfreenect2::atomic_size_t subscribed_frame_types_;
+
+  unsigned int subscribedFrameTypes() const;
+  void deliver(FrameList &frames, libfreenect2::FrameListener *listener);
+};
+
+/**
+ * Processes consecutive packets concurrently on one AsyncPacketProcessor per
+ * wrapped processor. Packets are dispatched round robin, a packet is only
+ * accepted when the next worker in turn has room in its queue, so the
+ * FrameSequencer sees the packets of each worker in the dispatch order.
+ * The wrapped processors have to deliver their frames to the listener given by
+ * FrameSequencer::port().
+ *
+ * Dropping queued packets would leave gaps the FrameSequencer waits for, so the
+ * DropOldest and Coalesce policies are replaced with DropNewest.
+ */
+template<typename PacketT>
+class ParallelPacketProcessor : public PacketProcessor<PacketT>, public BackpressureControl
+{
+public:
+  typedef PacketProcessor<PacketT>* PacketProcessorPtr;
+
+  ParallelPacketProcessor(const std::vector<PacketProcessorPtr> &processors, FrameSequencer *sequencer, size_t queue_size = 1) :
+    next_worker_(0)
+  {
+    for(size_t i = 0; i < processors.size(); ++i)
+    {
+      stages_.push_back(new SequencedStage(processors[i], sequencer, i));
+      workers_.push_back(new AsyncPacketProcessor<PacketT>(stages_.back(), queue_size));
+    }
+  }
+
+  virtual ~ParallelPacketProcessor()
+  {
+    for(size_t i = 0; i < workers_.size(); ++i)
+    {
+      delete workers_[i];
+      delete stages_[i];
+    }
+  }
+
+  virtual bool ready()
+  {
+    return workers_[next_worker_]->ready();
+  }
+
+  /** the workers are AsyncPacketProcessors, which gather the packets */
+  virtual bool gathersLentMemory() const
+  {
+    return true;
+  }
+
+  virtual void process(const PacketT &packet)
+  {
+    workers_[next_worker_]->process(packet);
+    next_worker_ = (next_worker_ + 1) % workers_.size();
+  }
+
+  virtual void setBackpressurePolicy(const BackpressurePolicy &policy)
+  {
+    BackpressurePolicy worker_policy = FrameSequencer::workerPolicy(policy);
+
+    for(size_t i = 0; i < workers_.size(); ++i)
+    {
+      workers_[i]->setBackpressurePolicy(worker_policy);
+    }
+  }
+
+  virtual BackpressureCounters backpressureCounters() const
+  {
+    BackpressureCounters counters;
+
+    for(size_t i = 0; i < workers_.size(); ++i)
+    {
+      counters += workers_[i]->backpressureCounters();
+    }
+
+    return counters;
+  }
+private:
+  class SequencedStage : public PacketProcessor<PacketT>
+  {
+  public:
+    SequencedStage(PacketProcessorPtr processor, FrameSequencer *sequencer, size_t worker) :
+      processor_(processor),
+      sequencer_(sequencer),
+      worker_(worker)
+    {
+    }
+
+    virtual void process(const PacketT &packet)
+    {
+      processor_->process(packet);
+      sequencer_->complete(worker_);
+    }
+  private:
+    PacketProcessorPtr processor_;
+    FrameSequencer *sequencer_;
+    size_t worker_;
+  };
+
+  std::vector<SequencedStage *> stages_;
+  std::vector<AsyncPacketProcessor<PacketT> *> workers_;
+  size_t next_worker_;
+};
+
+/**
+ * Runs several instances of a depth processor on consecutive packets, to reach
+ * the full frame rate when a single frame takes longer than the frame interval.
+ * Configuration calls are forwarded to all instances. The processing happens in
+ * its own worker threads, so it must not be wrapped in an AsyncPacketProcessor.
+ */
+class LIBFREENECT2_API ParallelDepthPacketProcessor : public DepthPacketProcessor, public BackpressureControl
+{
+public:
+  /** takes ownership of the processors */
+  ParallelDepthPacketProcessor(const std::vector<DepthPacketProcessor *> &processors, size_t queue_size = 1);
+  virtual ~ParallelDepthPacketProcessor();
+
+  virtual void setFrameListener(libfreenect2::FrameListener *listener);
+  virtual void setConfiguration(const libfreenect2::DepthPacketProcessor::Config &config);
+
+  virtual void loadP0TablesFromCommandResponse(unsigned char* buffer, size_t buffer_length);
+
+  virtual bool ready();
+  virtual void process(const DepthPacket &packet);
+  virtual bool gathersLentMemory() const;
+
+  virtual void setBackpressurePolicy(const BackpressurePolicy &policy);
+  virtual BackpressureCounters backpressureCounters() const;
+private:
+  std::vector<DepthPacketProcessor *> processors_;
+  FrameSequencer sequencer_;
+  ParallelPacketProcessor<DepthPacket> *parallel_;
+};
+
+/**
+ * Decodes consecutive color packets concurrently, for hosts on which a single
+ * decompressor does not keep up with the frame rate. Every processor instance
+ * keeps its own decompressor. The frames are passed on in packet order. The
+ * processing happens in its own worker threads, so it must not be wrapped in
+ * an AsyncPacketProcessor.
+ */
+class LIBFREENECT2_API ParallelRgbPacketProcessor : public RgbPacketProcessor, public BackpressureControl
+{
+public:
+  /** takes ownership of the processors */
+  ParallelRgbPacketProcessor(const std::vector<RgbPacketProcessor *> &processors, size_t queue_size = 1);
+  virtual ~ParallelRgbPacketProcessor();
+
+  virtual void setFrameListener(libfreenect2::FrameListener *listener);
+
+  virtual bool ready();
+  virtual void process(const RgbPacket &packet);
+  virtual bool gathersLentMemory() const;
+
+  virtual void setBackpressurePolicy(const BackpressurePolicy &policy);
+  virtual BackpressureCounters backpressureCounters() const;
+private:
+  std::vector<RgbPacketProcessor *> processors_;
+  FrameSequencer sequencer_;
+  ParallelPacketProcessor<RgbPacket> *parallel_;
+};
+
+} /* namespace libfreenect2 */
+#endif /* PARALLEL_PACKET_PROCESSOR_H_ */
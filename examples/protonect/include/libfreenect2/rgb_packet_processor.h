@@ -37,13 +37,25 @@
 namespace libfreenect2
 {
 
+struct PacketBuffer;
+
 struct LIBFREENECT2_API RgbPacket
 {
+  RgbPacket() : memory(0) {}
+
   uint32_t sequence;
 
   uint32_t timestamp;
+  // the complete image, unless the processor opted in to PacketProcessor::gathersLentMemory()
   unsigned char *jpeg_buffer;
   size_t jpeg_buffer_length;
+
+  // transfer and parser stages, processors copy it to their frames
+  FrameTrace trace;
+
+  // buffer backing the packet data, processors deferring the processing have to retain it,
+  // processors gathering lent memory have to call gather() before reading jpeg_buffer
+  PacketBuffer *memory;
 };
 
 typedef PacketProcessor<RgbPacket> BaseRgbPacketProcessor;
@@ -30,7 +30,9 @@
 #include <stddef.h>
 
 #include <libfreenect2/config.h>
-#include <libfreenect2/double_buffer.h>
+#include <libfreenect2/packet_buffer_ring.h>
+#include <libfreenect2/stream_statistics.h>
+#include <libfreenect2/threading.h>
 #include <libfreenect2/rgb_packet_processor.h>
 
 #include <libfreenect2/data_callback.h>
@@ -41,15 +43,33 @@ namespace libfreenect2
 class LIBFREENECT2_API RgbPacketStreamParser : public DataCallback
 {
 public:
-  RgbPacketStreamParser();
+  /** num_buffers packet buffers are allocated, see AsyncPacketProcessor how many are needed */
+  RgbPacketStreamParser(size_t num_buffers = 4);
   virtual ~RgbPacketStreamParser();
 
   void setPacketProcessor(BaseRgbPacketProcessor *processor);
 
   virtual void onDataReceived(unsigned char* buffer, size_t length);
+  virtual bool onDataLent(unsigned char* buffer, size_t length, DataReference *reference);
+
+  /** can be called from any thread */
+  ParserStatistics statistics() const;
 private:
-  libfreenect2::DoubleBuffer buffer_;
+  void onData(unsigned char* buffer, size_t length, DataReference *reference);
+
+  libfreenect2::PacketBufferRing buffer_;
+  // buffer the incoming data is currently appended to
+  libfreenect2::PacketBuffer *current_;
   BaseRgbPacketProcessor *processor_;
+  // stages of the packet being assembled
+  FrameTrace trace_;
+
+  // counters behind statistics(), only written by the thread calling onDataReceived()
+  libfreenect2::atomic_size_t received_bytes_;
+  libfreenect2::atomic_size_t completed_frames_;
+  libfreenect2::atomic_size_t dropped_busy_;
+  libfreenect2::atomic_size_t dropped_incomplete_;
+  libfreenect2::atomic_size_t dropped_invalid_;
 };
 
 } /* namespace libfreenect2 */
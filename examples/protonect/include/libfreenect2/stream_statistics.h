@@ -0,0 +1,83 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+
+#ifndef STREAM_STATISTICS_H_
+#define STREAM_STATISTICS_H_
+
+#include <stddef.h>
+
+#include <libfreenect2/config.h>
+
+namespace libfreenect2
+{
+
+/** what a usb transfer pool received since the device was opened */
+struct LIBFREENECT2_API TransferStatistics
+{
+  size_t transfers;
+  size_t bytes;
+  // transfers which did not complete, e.g. stalled or timed out
+  size_t transfer_errors;
+  // iso packets with an error status, their data is skipped
+  size_t iso_packet_errors;
+  // failed submissions of transfers, each one reduces the transfers in flight
+  size_t submit_failures;
+
+  TransferStatistics();
+};
+
+/** what a packet stream parser received and assembled since the device was opened */
+struct LIBFREENECT2_API ParserStatistics
+{
+  size_t bytes;
+  // packets passed to the processor
+  size_t frames;
+  // complete packets skipped, because all packet buffers were in use, the
+  // packets refused by the processor queue are only in its BackpressureCounters
+  size_t dropped_busy;
+  // packets abandoned with parts missing
+  size_t dropped_incomplete;
+  // packets discarded, because of inconsistent sizes, sequence numbers or content
+  size_t dropped_invalid;
+  // depth only, bit i is set if sub image i was missing from an incomplete packet
+  size_t missing_subsequences;
+  size_t last_missing_subsequences;
+
+  ParserStatistics();
+};
+
+/** snapshot of the counters of all stream stages of a device */
+struct LIBFREENECT2_API StreamStatistics
+{
+  TransferStatistics rgb_transfers;
+  TransferStatistics ir_transfers;
+  ParserStatistics rgb;
+  ParserStatistics depth;
+};
+
+} /* namespace libfreenect2 */
+#endif /* STREAM_STATISTICS_H_ */
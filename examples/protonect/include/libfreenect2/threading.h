@@ -28,6 +28,7 @@
 #define THREADING_H_
 
 #include <libfreenect2/config.h>
+#include <stddef.h>
 
 #ifdef LIBFREENECT2_THREADING_STDLIB
 
@@ -35,6 +36,7 @@
 #include <mutex>
 #include <condition_variable>
 #include <chrono>
+#include <atomic>
 
 #define WAIT_CONDITION(var, mutex, lock) var.wait(lock);
 
@@ -46,6 +48,7 @@ typedef std::mutex mutex;
 typedef std::lock_guard<std::mutex> lock_guard;
 typedef std::unique_lock<std::mutex> unique_lock;
 typedef std::condition_variable condition_variable;
+typedef std::atomic<size_t> atomic_size_t;
 
 namespace chrono
 {
@@ -78,6 +81,61 @@ typedef tthread::lock_guard<tthread::mutex> lock_guard;
 typedef tthread::lock_guard<tthread::mutex> unique_lock;
 typedef tthread::condition_variable condition_variable;
 
+// sequentially consistent load, store, compare exchange and fetch add of a size_t, the subset of std::atomic used by libfreenect2
+class atomic_size_t
+{
+public:
+  atomic_size_t(size_t value = 0) : value_(value) {}
+
+  size_t load() const
+  {
+    barrier();
+    size_t value = value_;
+    barrier();
+    return value;
+  }
+
+  void store(size_t value)
+  {
+    barrier();
+    value_ = value;
+    barrier();
+  }
+
+  bool compare_exchange_strong(size_t &expected, size_t desired)
+  {
+#ifdef _MSC_VER
+    size_t previous = (size_t)InterlockedCompareExchangePointer((PVOID volatile *)&value_, (PVOID)desired, (PVOID)expected);
+#else
+    size_t previous = __sync_val_compare_and_swap(&value_, expected, desired);
+#endif
+    bool exchanged = previous == expected;
+    expected = previous;
+    return exchanged;
+  }
+
+  size_t fetch_add(size_t value)
+  {
+    size_t expected = load();
+    while(!compare_exchange_strong(expected, expected + value));
+    return expected;
+  }
+private:
+  volatile size_t value_;
+
+  atomic_size_t(const atomic_size_t &);
+  atomic_size_t &operator=(const atomic_size_t &);
+
+  static void barrier()
+  {
+#ifdef _MSC_VER
+    MemoryBarrier();
+#else
+    __sync_synchronize();
+#endif
+  }
+};
+
 namespace chrono
 {
 using namespace tthread::chrono;
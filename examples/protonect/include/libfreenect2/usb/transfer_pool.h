@@ -32,6 +32,7 @@
 
 #include <libfreenect2/data_callback.h>
 #include <libfreenect2/threading.h>
+#include <libfreenect2/stream_statistics.h>
 
 namespace libfreenect2
 {
@@ -43,8 +44,10 @@ class TransferPool
 {
 public:
   TransferPool(libusb_device_handle *device_handle, unsigned char device_endpoint);
+  /** waits until the callback released all lent buffers, their owner has to go first */
   virtual ~TransferPool();
 
+  /** frees the transfers, or lets the release of the last lent buffer do it */
   void deallocate();
 
   void enableSubmission();
@@ -56,15 +59,24 @@ public:
   void cancel();
 
   void setCallback(DataCallback *callback);
+
+  /** can be called from any thread */
+  TransferStatistics statistics() const;
 protected:
   libfreenect2::mutex stopped_mutex;
-  struct Transfer
+  // a transfer is in flight when it is not stopped, lent transfers are stopped
+  struct Transfer : public DataReference
   {
     libusb_transfer *transfer;
     TransferPool *pool;
     bool stopped;
+    bool lent;
     Transfer(libusb_transfer *transfer, TransferPool *pool):
-      transfer(transfer), pool(pool), stopped(true) {}
+      transfer(transfer), pool(pool), stopped(true), lent(false) {}
+    virtual void release()
+    {
+      pool->onTransferReleased(this);
+    }
     void setStopped(bool value)
     {
       libfreenect2::lock_guard guard(pool->stopped_mutex);
@@ -76,15 +88,27 @@ protected:
       return stopped;
     }
   };
+  friend struct Transfer;
 
-  void allocateTransfers(size_t num_transfers, size_t transfer_size);
+  /** waits for a pending deallocate(), fails if the transfers are allocated already */
+  bool allocateTransfers(size_t num_transfers, size_t transfer_size);
 
   virtual libusb_transfer *allocateTransfer() = 0;
   virtual void fillTransfer(libusb_transfer *transfer) = 0;
 
-  virtual void processTransfer(libusb_transfer *transfer) = 0;
+  /** returns true if the callback kept the buffer, reference is 0 if it can not be lent */
+  virtual bool processTransfer(libusb_transfer *transfer, DataReference *reference) = 0;
 
   DataCallback *callback_;
+  // whether the buffers of completed transfers can be lent to the callback
+  bool lend_buffers_;
+
+  // counters behind statistics()
+  libfreenect2::atomic_size_t completed_transfers_;
+  libfreenect2::atomic_size_t received_bytes_;
+  libfreenect2::atomic_size_t transfer_errors_;
+  libfreenect2::atomic_size_t iso_packet_errors_;
+  libfreenect2::atomic_size_t submit_failures_;
 private:
   typedef std::vector<Transfer> TransferQueue;
 
@@ -97,9 +121,24 @@ private:
 
   bool enable_submit_;
 
+  // transfers kept in flight by submit(), index after the last submitted transfer
+  size_t num_parallel_transfers_;
+  size_t next_transfer_;
+  bool deallocate_pending_;
+  // signaled with stopped_mutex held once a pending deallocation freed the transfers
+  libfreenect2::condition_variable deallocated_;
+
   static void onTransferCompleteStatic(libusb_transfer *transfer);
 
   void onTransferComplete(Transfer *transfer);
+  void onTransferReleased(Transfer *transfer);
+
+  // need stopped_mutex
+  Transfer *idleTransfer(Transfer *except);
+  size_t numTransfersInFlight() const;
+  size_t numTransfersLent() const;
+
+  void submitTransfer(Transfer *transfer);
 };
 
 class BulkTransferPool : public TransferPool
@@ -108,12 +147,12 @@ public:
   BulkTransferPool(libusb_device_handle *device_handle, unsigned char device_endpoint);
   virtual ~BulkTransferPool();
 
-  void allocate(size_t num_transfers, size_t transfer_size);
+  bool allocate(size_t num_transfers, size_t transfer_size);
 
 protected:
   virtual libusb_transfer *allocateTransfer();
   virtual void fillTransfer(libusb_transfer *transfer);
-  virtual void processTransfer(libusb_transfer *transfer);
+  virtual bool processTransfer(libusb_transfer *transfer, DataReference *reference);
 };
 
 class IsoTransferPool : public TransferPool
@@ -122,12 +161,12 @@ public:
   IsoTransferPool(libusb_device_handle *device_handle, unsigned char device_endpoint);
   virtual ~IsoTransferPool();
 
-  void allocate(size_t num_transfers, size_t num_packets, size_t packet_size);
+  bool allocate(size_t num_transfers, size_t num_packets, size_t packet_size);
 
 protected:
   virtual libusb_transfer *allocateTransfer();
   virtual void fillTransfer(libusb_transfer *transfer);
-  virtual void processTransfer(libusb_transfer *transfer);
+  virtual bool processTransfer(libusb_transfer *transfer, DataReference *reference);
 
 private:
   size_t num_packets_;
@@ -25,14 +25,19 @@
  */
 
 #include <libfreenect2/depth_packet_processor.h>
+#include <libfreenect2/frame_pool.h>
 #include <libfreenect2/resource.h>
+#include <libfreenect2/threading.h>
 #include <libfreenect2/protocol/response.h>
 
 #include <opencv2/opencv.hpp>
 #include <iostream>
 #include <fstream>
 
+#include <algorithm>
+#include <cstring>
 #include <limits>
+#include <vector>
 
 #if defined(WIN32)
 #define _USE_MATH_DEFINES
@@ -55,12 +60,272 @@ bool loadBufferFromFile2(const std::string& filename, unsigned char *buffer, siz
   return success;
 }
 
-inline int bfi(int width, int offset, int src2, int src3)
+/**
+ * Decodes one row of a raw sub image into 512 measurements ordered by pixel column.
+ *
+ * A row is stored as 352 16bit words holding 512 packed 11bit values. Value j belongs to
+ * column x = (j % 128) * 4 + j / 128 (the bfi(2, 7, x, 0) + (x >> 2) of the original shader),
+ * the first and the last column are always lut11to16[0]. Rows are stored bottom half first.
+ *
+ * Every 16 values occupy exactly 11 words, so the shifts within a group are constant and the
+ * unpacking loop is free of data dependent branches.
+ */
+void decodeMeasurementRow(const unsigned char* data, const int16_t *lut11to16, int sub, int y, int16_t *out)
+{
+  // 298496 = 512 * 424 * 11 / 8 = number of bytes per sub image
+  const uint16_t *ptr = reinterpret_cast<const uint16_t *>(data + 298496 * sub);
+  int i = y < 212 ? y + 212 : 423 - y;
+  ptr += 352*i;
+
+  uint16_t values[512];
+
+  for(int group = 0; group < 32; ++group, ptr += 11)
+  {
+    uint16_t *v = values + group * 16;
+
+    for(int k = 0; k < 15; ++k)
+    {
+      int bit = k * 11;
+      uint32_t word = uint32_t(ptr[bit >> 4]) | (uint32_t(ptr[(bit >> 4) + 1]) << 16);
+      v[k] = (word >> (bit & 15)) & 2047;
+    }
+    // last value ends at the word boundary, don't touch the next group
+    v[15] = ptr[10] >> 5;
+  }
+
+  for(int x = 0; x < 512; ++x)
+  {
+    out[x] = lut11to16[values[(x & 3) * 128 + (x >> 2)]];
+  }
+
+  out[0] = lut11to16[0];
+  out[511] = lut11to16[0];
+}
+
+/**
+ * Branch free approximations used by the fast math mode of stage 2. They are plain scalar code without intrinsics,
+ * which avoids the libm calls and leaves vectorization to the compiler. Maximum errors compared with the double
+ * precision functions:
+ * fastAtan2 2.7e-7 rad, fastLog 1.2e-7 (relative for |log(x)| > 1, absolute otherwise) for positive normal x,
+ * fastExp 2.5e-7 relative, fastFloor is exact for |x| < 2^31.
+ */
+static inline float fastAtan2(float y, float x)
+{
+  float ax = std::abs(x), ay = std::abs(y);
+  float mx = std::max(ax, ay), mn = std::min(ax, ay);
+  float a = mx > 0.0f ? mn / mx : 0.0f;
+
+  // reduce [tan(pi/8), 1] to [-0.1716, 0] with atan(a) = pi/4 + atan((a - 1) / (a + 1))
+  bool reduce = a > 0.41421356f;
+  float t = reduce ? (a - 1.0f) / (a + 1.0f) : a;
+  float z = t * t;
+  float r = (((8.05374449538e-2f * z - 1.38776856032e-1f) * z + 1.99777106478e-1f) * z - 3.33329491539e-1f) * z * t + t;
+
+  r = reduce ? r + 0.78539816f : r;
+  r = ay > ax ? 1.57079633f - r : r;
+  r = x < 0.0f ? 3.14159265f - r : r;
+  return y < 0.0f ? -r : r;
+}
+
+static inline float fastLog(float x)
+{
+  uint32_t bits;
+  std::memcpy(&bits, &x, sizeof(bits));
+
+  int e = int((bits >> 23) & 255) - 127;
+  bits = (bits & 0x007fffff) | 0x3f800000;
+
+  float m;
+  std::memcpy(&m, &bits, sizeof(m));
+
+  // move the mantissa from [1, 2) to [sqrt(0.5), sqrt(2)), log(m) = 2 atanh((m - 1) / (m + 1))
+  bool halve = m > 1.41421356f;
+  m = halve ? m * 0.5f : m;
+  e = halve ? e + 1 : e;
+
+  float t = (m - 1.0f) / (m + 1.0f);
+  float t2 = t * t;
+  float l = 2.0f * t * (1.0f + t2 * (0.33333333f + t2 * (0.2f + t2 * (0.14285714f + t2 * 0.11111111f))));
+
+  return float(e) * 0.69314718f + l;
+}
+
+static inline float fastFloor(float x)
+{
+  float i = float(int(x));
+  return x < i ? i - 1.0f : i;
+}
+
+static inline float fastExp(float x)
+{
+  x = std::min(std::max(x, -87.0f), 88.0f);
+
+  // exp(x) = 2^n * exp(f), ln(2) is split in two parts to keep f exact
+  float n = fastFloor(x * 1.44269504f + 0.5f);
+  float f = (x - n * 0.693145751953125f) - n * 1.428606820e-6f;
+  float p = 1.0f + f * (1.0f + f * (0.5f + f * (0.16666667f + f * (0.04166667f + f * (0.00833333f + f * 0.00138889f)))));
+
+  int32_t bits = (int32_t(n) + 127) << 23;
+  float scale;
+  std::memcpy(&scale, &bits, sizeof(scale));
+
+  return p * scale;
+}
+
+/**
+ * Planar storage of the stage 1 measurements, one 512x424 float plane per frequency
+ * for the a and b components and the amplitude n.
+ */
+struct MeasurementPlanes
+{
+  cv::Mat a[3], b[3], n[3];
+
+  void create()
+  {
+    for(int f = 0; f < 3; ++f)
+    {
+      a[f].create(424, 512, CV_32FC1);
+      b[f].create(424, 512, CV_32FC1);
+      n[f].create(424, 512, CV_32FC1);
+    }
+  }
+};
+
+/**
+ * Pointers to one row of stage 1 measurements, either in MeasurementPlanes or in a MeasurementRowBuffer.
+ */
+struct MeasurementRow
+{
+  float *a[3], *b[3], *n[3];
+};
+
+struct ConstMeasurementRow
+{
+  const float *a[3], *b[3], *n[3];
+};
+
+/**
+ * Storage for a single row of stage 1 measurements, used by the fused pipeline.
+ */
+struct MeasurementRowBuffer
+{
+  float a[3][512], b[3][512], n[3][512];
+};
+
+static MeasurementRow measurementRow(MeasurementPlanes &planes, int y)
+{
+  MeasurementRow row;
+
+  for(int f = 0; f < 3; ++f)
+  {
+    row.a[f] = planes.a[f].ptr<float>(y);
+    row.b[f] = planes.b[f].ptr<float>(y);
+    row.n[f] = planes.n[f].ptr<float>(y);
+  }
+
+  return row;
+}
+
+static ConstMeasurementRow constMeasurementRow(const MeasurementPlanes &planes, int y)
+{
+  ConstMeasurementRow row;
+
+  for(int f = 0; f < 3; ++f)
+  {
+    row.a[f] = planes.a[f].ptr<float>(y);
+    row.b[f] = planes.b[f].ptr<float>(y);
+    row.n[f] = planes.n[f].ptr<float>(y);
+  }
+
+  return row;
+}
+
+static MeasurementRow measurementRow(MeasurementRowBuffer &buffer)
+{
+  MeasurementRow row;
+
+  for(int f = 0; f < 3; ++f)
+  {
+    row.a[f] = buffer.a[f];
+    row.b[f] = buffer.b[f];
+    row.n[f] = buffer.n[f];
+  }
+
+  return row;
+}
+
+static ConstMeasurementRow constMeasurementRow(const MeasurementRowBuffer &buffer)
 {
-  int bitmask = (((1 << width)-1) << offset) & 0xffffffff;
-  return ((src2 << offset) & bitmask) | (src3 & ~bitmask);
+  ConstMeasurementRow row;
+
+  for(int f = 0; f < 3; ++f)
+  {
+    row.a[f] = buffer.a[f];
+    row.b[f] = buffer.b[f];
+    row.n[f] = buffer.n[f];
+  }
+
+  return row;
 }
 
+/**
+ * Per band scratch rows of the fused pipeline. Every stage keeps only the rows its successor
+ * still needs, row y lives in slot y % 3, so the working set of a band stays in the cache.
+ */
+struct FusedRowBuffers
+{
+  MeasurementRowBuffer measurements[3];
+  MeasurementRowBuffer filtered;
+  unsigned char max_edge_test[3][512];
+  float raw_depth[3][512], masked_depth[3][512], ir_sum[3][512];
+  // ir output of halo rows, which belong to the neighbouring band
+  float ir_halo[512];
+};
+
+class CpuDepthPacketProcessorImpl;
+
+/**
+ * Runs one stage of the depth pipeline on horizontal bands of the image.
+ * The calling thread processes the first band, every worker thread one of the remaining bands.
+ * Stages only read rows written by the previous stage, so the 3x3 filters see their one row halo
+ * as soon as run() returned for the previous stage.
+ */
+class RowBandWorkerPool
+{
+public:
+  typedef void (CpuDepthPacketProcessorImpl::*StageFunction)(size_t band, int y_begin, int y_end);
+
+  RowBandWorkerPool(CpuDepthPacketProcessorImpl *impl, size_t num_bands);
+  ~RowBandWorkerPool();
+
+  size_t numBands() const;
+
+  void run(StageFunction stage);
+private:
+  struct Worker
+  {
+    RowBandWorkerPool *pool;
+    size_t band;
+    libfreenect2::thread *thread;
+  };
+
+  CpuDepthPacketProcessorImpl *impl_;
+  size_t num_bands_;
+  std::vector<Worker> workers_;
+
+  libfreenect2::mutex mutex_;
+  libfreenect2::condition_variable work_condition_, done_condition_;
+  StageFunction stage_;
+  size_t generation_;
+  size_t pending_;
+  bool shutdown_;
+
+  void runBand(StageFunction stage, size_t band);
+
+  static void static_execute(void *data);
+  void execute(size_t band);
+};
+
 class CpuDepthPacketProcessorImpl
 {
 public:
@@ -68,24 +333,43 @@ public:
 
   int16_t lut11to16[2048];
 
-  float trig_table0[512*424][6];
-  float trig_table1[512*424][6];
-  float trig_table2[512*424][6];
+  // cos(p0) and sin(p0) per pixel, the phase shifted values are derived by angle addition with phase_in_rad,
+  // DepthAccuracy compares the result with full per phase tables
+  float trig_table0[512*424][2];
+  float trig_table1[512*424][2];
+  float trig_table2[512*424][2];
+  float phase_cos[3], phase_sin[3];
 
   double timing_acc;
   double timing_acc_n;
 
   double timing_current_start;
 
-  bool enable_bilateral_filter, enable_edge_filter;
+  bool enable_bilateral_filter, enable_edge_filter, enable_fused_pipeline, enable_fast_math;
   DepthPacketProcessor::Parameters params;
 
   Frame *ir_frame, *depth_frame;
+  FramePool *ir_frame_pool, *depth_frame_pool;
 
   bool flip_ptables;
 
+  RowBandWorkerPool *workers;
+  std::vector<FusedRowBuffers> fused_buffers;
+  // instantiations of the stage templates for the current filter configuration
+  RowBandWorkerPool::StageFunction rows_stage2, rows_fused;
+
+  // state of the frame currently processed by the stage functions
+  unsigned char *packet_data;
+  MeasurementPlanes m, m_filtered;
+  MeasurementPlanes *stage2_input;
+  cv::Mat m_max_edge_test, raw_depth_plane, masked_depth_plane, ir_sum_plane, out_ir, out_depth;
+  // max edge test result of a row if the bilateral filter is disabled
+  unsigned char max_edge_test_passed[512];
+
   CpuDepthPacketProcessorImpl()
   {
+    ir_frame_pool = new FramePool(512, 424, 4);
+    depth_frame_pool = new FramePool(512, 424, 4);
     newIrFrame();
     newDepthFrame();
 
@@ -95,8 +379,90 @@ public:
 
     enable_bilateral_filter = true;
     enable_edge_filter = true;
+    enable_fused_pipeline = false;
+    enable_fast_math = false;
 
     flip_ptables = true;
+
+    workers = new RowBandWorkerPool(this, 1);
+    fused_buffers.resize(1);
+    selectStageFunctions();
+
+    packet_data = 0;
+    stage2_input = 0;
+    std::fill(max_edge_test_passed, max_edge_test_passed + 512, 1);
+  }
+
+  ~CpuDepthPacketProcessorImpl()
+  {
+    delete workers;
+
+    delete ir_frame;
+    delete depth_frame;
+    ir_frame_pool->release();
+    depth_frame_pool->release();
+  }
+
+  void setNumThreads(size_t num_threads)
+  {
+    num_threads = std::max<size_t>(1, std::min<size_t>(num_threads, 424));
+
+    if(workers->numBands() != num_threads)
+    {
+      delete workers;
+      workers = new RowBandWorkerPool(this, num_threads);
+      fused_buffers.resize(num_threads);
+    }
+  }
+
+  void selectStageFunctions()
+  {
+    if(enable_fast_math)
+      selectStageFunctions<true>();
+    else
+      selectStageFunctions<false>();
+  }
+
+  template<bool FastMath>
+  void selectStageFunctions()
+  {
+    if(enable_edge_filter)
+    {
+      rows_stage2 = &CpuDepthPacketProcessorImpl::processRowsStage2<true, FastMath>;
+      rows_fused = enable_bilateral_filter ? &CpuDepthPacketProcessorImpl::processRowsFused<true, true, FastMath> : &CpuDepthPacketProcessorImpl::processRowsFused<false, true, FastMath>;
+    }
+    else
+    {
+      rows_stage2 = &CpuDepthPacketProcessorImpl::processRowsStage2<false, FastMath>;
+      rows_fused = enable_bilateral_filter ? &CpuDepthPacketProcessorImpl::processRowsFused<true, false, FastMath> : &CpuDepthPacketProcessorImpl::processRowsFused<false, false, FastMath>;
+    }
+  }
+
+  /**
+   * Allocates the full frame intermediates needed by the current configuration. cv::Mat::create only
+   * allocates if the buffer does not exist yet, so the steady state does not touch the heap.
+   */
+  void allocateFullFrameBuffers()
+  {
+    m.create();
+
+    if(enable_bilateral_filter)
+    {
+      m_filtered.create();
+      m_max_edge_test.create(424, 512, CV_8UC1);
+    }
+
+    if(enable_edge_filter)
+    {
+      raw_depth_plane.create(424, 512, CV_32FC1);
+      masked_depth_plane.create(424, 512, CV_32FC1);
+      ir_sum_plane.create(424, 512, CV_32FC1);
+    }
+  }
+
+  const unsigned char *maxEdgeTestRow(int y) const
+  {
+    return enable_bilateral_filter ? m_max_edge_test.ptr<unsigned char>(y) : max_edge_test_passed;
   }
 
   void startTiming()
@@ -120,108 +486,45 @@ public:
 
   void newIrFrame()
   {
-    ir_frame = new Frame(512, 424, 4);
-    //ir_frame = new Frame(512, 424, 12);
+    ir_frame = ir_frame_pool->allocate();
   }
 
   void newDepthFrame()
   {
-    depth_frame = new Frame(512, 424, 4);
-  }
-
-  int32_t decodePixelMeasurement(unsigned char* data, int sub, int x, int y)
-  {
-    // 298496 = 512 * 424 * 11 / 8 = number of bytes per sub image
-    uint16_t *ptr = reinterpret_cast<uint16_t *>(data + 298496 * sub);
-    int i = y < 212 ? y + 212 : 423 - y;
-    ptr += 352*i;
-
-    /**
-     r1.yz = r2.xxyx < l(0, 1, 0, 0) // ilt
-     r1.y = r1.z | r1.y // or
-     */
-    bool r1y = x < 1 || y < 0;
-    /*
-    r1.zw = l(0, 0, 510, 423) < r2.xxxy // ilt
-    r1.z = r1.w | r1.z // or
-    */
-    bool r1z = 510 < x || 423 < y;
-    /*
-    r1.y = r1.z | r1.y // or
-    */
-    r1y = r1y || r1z;
-    /*
-    r1.y = r1.y & l(0x1fffffff) // and
-    */
-    int r1yi = r1y ? 0xffffffff : 0x0;
-    r1yi &= 0x1fffffff;
-
-    /*
-    bfi r1.z, l(2), l(7), r2.x, l(0)
-    ushr r1.w, r2.x, l(2)
-    r1.z = r1.w + r1.z // iadd
-    */
-    int r1zi = bfi(2, 7, x, 0);
-    int r1wi = x >> 2;
-    r1zi = r1wi + r1zi;
-
-    /*
-    imul null, r1.z, r1.z, l(11)
-    ushr r1.w, r1.z, l(4)
-    r1.y = r1.w + r1.y // iadd
-    r1.w = r1.y + l(1) // iadd
-    r1.z = r1.z & l(15) // and
-    r4.w = -r1.z + l(16) // iadd
-     */
-    r1zi = (r1zi * 11L) & 0xffffffff;
-    r1wi = r1zi >> 4;
-    r1yi = r1yi + r1wi;
-    r1zi = r1zi & 15;
-    int r4wi = -r1zi + 16;
-
-    if(r1yi > 352)
-    {
-      return lut11to16[0];
-    }
-
-    int i1 = ptr[r1yi];
-    int i2 = ptr[r1yi + 1];
-    i1 = i1 >> r1zi;
-    i2 = i2 << r4wi;
-
-    return lut11to16[((i1 | i2) & 2047)];
-  }
-
-  void fill_trig_tables(cv::Mat& p0table, float trig_table[512*424][6])
+    depth_frame = depth_frame_pool->allocate();
+  }
+
+  void fill_trig_tables(cv::Mat& p0table, float trig_table[512*424][2])
   {
+    for(int i = 0; i < 3; ++i)
+    {
+      phase_cos[i] = std::cos(params.phase_in_rad[i]);
+      phase_sin[i] = std::sin(params.phase_in_rad[i]);
+    }
+
     for (int i = 0; i < 512*424; i++)
     {
       float p0 = -((float)p0table.at<uint16_t>(i)) * 0.000031 * M_PI;
 
-      float tmp0 = p0 + params.phase_in_rad[0];
-      float tmp1 = p0 + params.phase_in_rad[1];
-      float tmp2 = p0 + params.phase_in_rad[2];
-
-      trig_table[i][0] = std::cos(tmp0);
-      trig_table[i][1] = std::cos(tmp1);
-      trig_table[i][2] = std::cos(tmp2);
-
-      trig_table[i][3] = std::sin(-tmp0);
-      trig_table[i][4] = std::sin(-tmp1);
-      trig_table[i][5] = std::sin(-tmp2);
+      trig_table[i][0] = std::cos(p0);
+      trig_table[i][1] = std::sin(p0);
     }
   }
 
-  void processMeasurementTriple(float trig_table[512*424][6], float abMultiplierPerFrq, int x, int y, const int32_t* m, float* m_out)
+  void processMeasurementTriple(float trig_table[512*424][2], float abMultiplierPerFrq, int x, int y, const int32_t* m, float *a_out, float *b_out, float *n_out)
   {
     int offset = y * 512 + x;
-    float cos_tmp0 = trig_table[offset][0];
-    float cos_tmp1 = trig_table[offset][1];
-    float cos_tmp2 = trig_table[offset][2];
+    float cos_p0 = trig_table[offset][0];
+    float sin_p0 = trig_table[offset][1];
+
+    // cos(p0 + phase_in_rad) and sin(-(p0 + phase_in_rad))
+    float cos_tmp0 = cos_p0 * phase_cos[0] - sin_p0 * phase_sin[0];
+    float cos_tmp1 = cos_p0 * phase_cos[1] - sin_p0 * phase_sin[1];
+    float cos_tmp2 = cos_p0 * phase_cos[2] - sin_p0 * phase_sin[2];
 
-    float sin_negtmp0 = trig_table[offset][3];
-    float sin_negtmp1 = trig_table[offset][4];
-    float sin_negtmp2 = trig_table[offset][5];
+    float sin_negtmp0 = -(sin_p0 * phase_cos[0] + cos_p0 * phase_sin[0]);
+    float sin_negtmp1 = -(sin_p0 * phase_cos[1] + cos_p0 * phase_sin[1]);
+    float sin_negtmp2 = -(sin_p0 * phase_cos[2] + cos_p0 * phase_sin[2]);
 
     float zmultiplier = z_table.at<float>(y, x);
     bool cond0 = 0 < zmultiplier;
@@ -231,12 +534,10 @@ public:
     float tmp3 = cos_tmp0 * m[0] + cos_tmp1 * m[1] + cos_tmp2 * m[2];
     float tmp4 = sin_negtmp0 * m[0] + sin_negtmp1 * m[1] + sin_negtmp2 * m[2];
 
-    // only if modeMask & 32 != 0;
-    if(true)//(modeMask & 32) != 0)
-    {
-        tmp3 *= abMultiplierPerFrq;
-        tmp4 *= abMultiplierPerFrq;
-    }
+    // the shader only scales if (modeMask & 32) != 0, which is always the case for the modes we use
+    tmp3 *= abMultiplierPerFrq;
+    tmp4 *= abMultiplierPerFrq;
+
     float tmp5 = std::sqrt(tmp3 * tmp3 + tmp4 * tmp4) * params.ab_multiplier;
 
     // invalid pixel because zmultiplier < 0 ??
@@ -249,14 +550,21 @@ public:
     tmp4 = !cond1 ? tmp4 : 0;
     tmp5 = !cond1 ? tmp5 : 65535.0; // some kind of norm calculated from tmp3 and tmp4
 
-    m_out[0] = tmp3; // ir image a
-    m_out[1] = tmp4; // ir image b
-    m_out[2] = tmp5; // ir amplitude
+    *a_out = tmp3; // ir image a
+    *b_out = tmp4; // ir image b
+    *n_out = tmp5; // ir amplitude
+  }
+
+  template<bool FastMath>
+  static float floor(float x)
+  {
+    return FastMath ? fastFloor(x) : std::floor(x);
   }
 
+  template<bool FastMath>
   void transformMeasurements(float* m)
   {
-    float tmp0 = std::atan2((m[1]), (m[0]));
+    float tmp0 = FastMath ? fastAtan2(m[1], m[0]) : std::atan2((m[1]), (m[0]));
     tmp0 = tmp0 < 0 ? tmp0 + M_PI * 2.0f : tmp0;
     tmp0 = (tmp0 != tmp0) ? 0 : tmp0;
 
@@ -266,50 +574,57 @@ public:
     m[1] = tmp1; // ir amplitude - (possibly bilateral filtered)
   }
 
-  void processPixelStage1(int x, int y, unsigned char* data, float *m0_out, float *m1_out, float *m2_out)
+  void processPixelStage1(int x, int y, const int16_t raw[9][512], const MeasurementRow &out)
   {
     int32_t m0_raw[3], m1_raw[3], m2_raw[3];
 
-    m0_raw[0] = decodePixelMeasurement(data, 0, x, y);
-    m0_raw[1] = decodePixelMeasurement(data, 1, x, y);
-    m0_raw[2] = decodePixelMeasurement(data, 2, x, y);
-    m1_raw[0] = decodePixelMeasurement(data, 3, x, y);
-    m1_raw[1] = decodePixelMeasurement(data, 4, x, y);
-    m1_raw[2] = decodePixelMeasurement(data, 5, x, y);
-    m2_raw[0] = decodePixelMeasurement(data, 6, x, y);
-    m2_raw[1] = decodePixelMeasurement(data, 7, x, y);
-    m2_raw[2] = decodePixelMeasurement(data, 8, x, y);
-
-    processMeasurementTriple(trig_table0, params.ab_multiplier_per_frq[0], x, y, m0_raw, m0_out);
-    processMeasurementTriple(trig_table1, params.ab_multiplier_per_frq[1], x, y, m1_raw, m1_out);
-    processMeasurementTriple(trig_table2, params.ab_multiplier_per_frq[2], x, y, m2_raw, m2_out);
+    m0_raw[0] = raw[0][x];
+    m0_raw[1] = raw[1][x];
+    m0_raw[2] = raw[2][x];
+    m1_raw[0] = raw[3][x];
+    m1_raw[1] = raw[4][x];
+    m1_raw[2] = raw[5][x];
+    m2_raw[0] = raw[6][x];
+    m2_raw[1] = raw[7][x];
+    m2_raw[2] = raw[8][x];
+
+    processMeasurementTriple(trig_table0, params.ab_multiplier_per_frq[0], x, y, m0_raw, out.a[0] + x, out.b[0] + x, out.n[0] + x);
+    processMeasurementTriple(trig_table1, params.ab_multiplier_per_frq[1], x, y, m1_raw, out.a[1] + x, out.b[1] + x, out.n[1] + x);
+    processMeasurementTriple(trig_table2, params.ab_multiplier_per_frq[2], x, y, m2_raw, out.a[2] + x, out.b[2] + x, out.n[2] + x);
   }
 
-  void filterPixelStage1(int x, int y, const cv::Mat& m, float* m_out, bool& bilateral_max_edge_test)
+  /**
+   * rows holds the measurement rows y - 1, y and y + 1, the outer ones are not accessed in the first and the last row.
+   */
+  void filterPixelStage1(int x, int y, const ConstMeasurementRow rows[3], const MeasurementRow &out, bool& bilateral_max_edge_test)
   {
-    const float *m_ptr = m.ptr<float>(y, x);
     bilateral_max_edge_test = true;
 
     if(x < 1 || y < 1 || x > 510 || y > 422)
     {
-      for(int i = 0; i < 9; ++i)
-        m_out[i] = m_ptr[i];
+      for(int f = 0; f < 3; ++f)
+      {
+        out.a[f][x] = rows[1].a[f][x];
+        out.b[f][x] = rows[1].b[f][x];
+        out.n[f][x] = rows[1].n[f][x];
+      }
     }
     else
     {
       float m_normalized[2];
       float other_m_normalized[2];
 
-      int offset = 0;
-
-      for(int i = 0; i < 3; ++i, m_ptr += 3, m_out += 3, offset += 3)
+      for(int f = 0; f < 3; ++f)
       {
-        float norm2 = m_ptr[0] * m_ptr[0] + m_ptr[1] * m_ptr[1];
+        const float *a = rows[1].a[f] + x;
+        const float *b = rows[1].b[f] + x;
+
+        float norm2 = a[0] * a[0] + b[0] * b[0];
         float inv_norm = 1.0f / std::sqrt(norm2);
         inv_norm = (inv_norm == inv_norm) ? inv_norm : std::numeric_limits<float>::infinity();
 
-        m_normalized[0] = m_ptr[0] * inv_norm;
-        m_normalized[1] = m_ptr[1] * inv_norm;
+        m_normalized[0] = a[0] * inv_norm;
+        m_normalized[1] = b[0] * inv_norm;
 
         int j = 0;
 
@@ -335,19 +650,19 @@ public:
             {
               weight_acc += params.gaussian_kernel[j];
 
-              weighted_m_acc[0] += params.gaussian_kernel[j] * m_ptr[0];
-              weighted_m_acc[1] += params.gaussian_kernel[j] * m_ptr[1];
+              weighted_m_acc[0] += params.gaussian_kernel[j] * a[0];
+              weighted_m_acc[1] += params.gaussian_kernel[j] * b[0];
               continue;
             }
 
-            const float *other_m_ptr = m.ptr<float>(y + yi, x + xi) + offset;
-            float other_norm2 = other_m_ptr[0] * other_m_ptr[0] + other_m_ptr[1] * other_m_ptr[1];
+            const float other_a = rows[1 + yi].a[f][x + xi], other_b = rows[1 + yi].b[f][x + xi];
+            float other_norm2 = other_a * other_a + other_b * other_b;
             // TODO: maybe fix numeric problems when norm = 0 - original code uses reciprocal square root, which returns +inf for +0
             float other_inv_norm = 1.0f / std::sqrt(other_norm2);
             other_inv_norm = (other_inv_norm == other_inv_norm) ? other_inv_norm : std::numeric_limits<float>::infinity();
 
-            other_m_normalized[0] = other_m_ptr[0] * other_inv_norm;
-            other_m_normalized[1] = other_m_ptr[1] * other_inv_norm;
+            other_m_normalized[0] = other_a * other_inv_norm;
+            other_m_normalized[1] = other_b * other_inv_norm;
 
             float dist = -(other_m_normalized[0] * m_normalized[0] + other_m_normalized[1] * m_normalized[1]);
             dist += 1.0f;
@@ -361,8 +676,8 @@ public:
               dist_acc += dist;
             }
 
-            weighted_m_acc[0] += weight * other_m_ptr[0];
-            weighted_m_acc[1] += weight * other_m_ptr[1];
+            weighted_m_acc[0] += weight * other_a;
+            weighted_m_acc[1] += weight * other_b;
 
             weight_acc += weight;
           }
@@ -370,13 +685,14 @@ public:
 
         bilateral_max_edge_test = bilateral_max_edge_test && dist_acc < params.joint_bilateral_max_edge;
 
-        m_out[0] = 0.0f < weight_acc ? weighted_m_acc[0] / weight_acc : 0.0f;
-        m_out[1] = 0.0f < weight_acc ? weighted_m_acc[1] / weight_acc : 0.0f;
-        m_out[2] = m_ptr[2];
+        out.a[f][x] = 0.0f < weight_acc ? weighted_m_acc[0] / weight_acc : 0.0f;
+        out.b[f][x] = 0.0f < weight_acc ? weighted_m_acc[1] / weight_acc : 0.0f;
+        out.n[f][x] = rows[1].n[f][x];
       }
     }
   }
 
+  template<bool FastMath>
   void processPixelStage2(int x, int y, float *m0, float *m1, float *m2, float *ir_out, float *depth_out, float *ir_sum_out)
   {
     //// 10th measurement
@@ -388,104 +704,86 @@ public:
     //// if m9 is positive or pixel is invalid (zmultiplier) we set it to 0 otherwise to its absolute value O.o
     //m9 = cond0 ? 0 : m9;
 
-    transformMeasurements(m0);
-    transformMeasurements(m1);
-    transformMeasurements(m2);
+    transformMeasurements<FastMath>(m0);
+    transformMeasurements<FastMath>(m1);
+    transformMeasurements<FastMath>(m2);
 
     float ir_sum = m0[1] + m1[1] + m2[1];
 
+    // the shader skips the disambiguation in DISABLE_DISAMBIGUATION mode, which we never use
     float phase;
-    // if(DISABLE_DISAMBIGUATION)
-    if(false)
-    {
-        //r0.yz = r3.zx + r4.zx // add
-        //r0.yz = r5.xz + r0.zy // add
-        float phase = m0[0] + m1[0] + m2[0]; // r0.y
-        float tmp1 = m0[2] + m1[2] + m2[2];  // r0.z
+    float ir_min = std::min(std::min(m0[1], m1[1]), m2[1]);
 
-        //r7.xyz = r3.zxy + r4.zxy // add
-        //r4.xyz = r5.zyx + r7.xzy // add
-        float tmp2 = m0[0] + m1[0] + m2[0]; // r4.z
-        //r3.zw = r4.xy // mov
-        float tmp3 = m0[2] + m1[2] + m2[2]; // r3.z
-        float tmp4 = m0[1] + m1[1] + m2[1]; // r3.w
+    if (ir_min < params.individual_ab_threshold || ir_sum < params.ab_threshold)
+    {
+      phase = 0;
     }
     else
     {
-      float ir_min = std::min(std::min(m0[1], m1[1]), m2[1]);
+      float t0 = m0[0] / (2.0f * M_PI) * 3.0f;
+      float t1 = m1[0] / (2.0f * M_PI) * 15.0f;
+      float t2 = m2[0] / (2.0f * M_PI) * 2.0f;
 
-      if (ir_min < params.individual_ab_threshold || ir_sum < params.ab_threshold)
-      {
-        phase = 0;
-      }
-      else
-      {
-        float t0 = m0[0] / (2.0f * M_PI) * 3.0f;
-        float t1 = m1[0] / (2.0f * M_PI) * 15.0f;
-        float t2 = m2[0] / (2.0f * M_PI) * 2.0f;
+      float t5 = (floor<FastMath>((t1 - t0) * 0.333333f + 0.5f) * 3.0f + t0);
+      float t3 = (-t2 + t5);
+      float t4 = t3 * 2.0f;
 
-        float t5 = (std::floor((t1 - t0) * 0.333333f + 0.5f) * 3.0f + t0);
-        float t3 = (-t2 + t5);
-        float t4 = t3 * 2.0f;
+      bool c1 = t4 >= -t4; // true if t4 positive
 
-        bool c1 = t4 >= -t4; // true if t4 positive
+      float f1 = c1 ? 2.0f : -2.0f;
+      float f2 = c1 ? 0.5f : -0.5f;
+      t3 *= f2;
+      t3 = (t3 - floor<FastMath>(t3)) * f1;
 
-        float f1 = c1 ? 2.0f : -2.0f;
-        float f2 = c1 ? 0.5f : -0.5f;
-        t3 *= f2;
-        t3 = (t3 - std::floor(t3)) * f1;
+      bool c2 = 0.5f < std::abs(t3) && std::abs(t3) < 1.5f;
 
-        bool c2 = 0.5f < std::abs(t3) && std::abs(t3) < 1.5f;
+      float t6 = c2 ? t5 + 15.0f : t5;
+      float t7 = c2 ? t1 + 15.0f : t1;
 
-        float t6 = c2 ? t5 + 15.0f : t5;
-        float t7 = c2 ? t1 + 15.0f : t1;
+      float t8 = (floor<FastMath>((-t2 + t6) * 0.5f + 0.5f) * 2.0f + t2) * 0.5f;
 
-        float t8 = (std::floor((-t2 + t6) * 0.5f + 0.5f) * 2.0f + t2) * 0.5f;
+      t6 *= 0.333333f; // = / 3
+      t7 *= 0.066667f; // = / 15
 
-        t6 *= 0.333333f; // = / 3
-        t7 *= 0.066667f; // = / 15
+      float t9 = (t8 + t6 + t7); // transformed phase measurements (they are transformed and divided by the values the original values were multiplied with)
+      float t10 = t9 * 0.333333f; // some avg
 
-        float t9 = (t8 + t6 + t7); // transformed phase measurements (they are transformed and divided by the values the original values were multiplied with)
-        float t10 = t9 * 0.333333f; // some avg
+      t6 *= 2.0f * M_PI;
+      t7 *= 2.0f * M_PI;
+      t8 *= 2.0f * M_PI;
 
-        t6 *= 2.0f * M_PI;
-        t7 *= 2.0f * M_PI;
-        t8 *= 2.0f * M_PI;
+      // some cross product
+      float t8_new = t7 * 0.826977f - t8 * 0.110264f;
+      float t6_new = t8 * 0.551318f - t6 * 0.826977f;
+      float t7_new = t6 * 0.110264f - t7 * 0.551318f;
 
-        // some cross product
-        float t8_new = t7 * 0.826977f - t8 * 0.110264f;
-        float t6_new = t8 * 0.551318f - t6 * 0.826977f;
-        float t7_new = t6 * 0.110264f - t7 * 0.551318f;
+      t8 = t8_new;
+      t6 = t6_new;
+      t7 = t7_new;
 
-        t8 = t8_new;
-        t6 = t6_new;
-        t7 = t7_new;
+      float norm = t8 * t8 + t6 * t6 + t7 * t7;
+      float mask = t9 >= 0.0f ? 1.0f : 0.0f;
+      t10 *= mask;
 
-        float norm = t8 * t8 + t6 * t6 + t7 * t7;
-        float mask = t9 >= 0.0f ? 1.0f : 0.0f;
-        t10 *= mask;
+      bool slope_positive = 0 < params.ab_confidence_slope;
 
-        bool slope_positive = 0 < params.ab_confidence_slope;
+      float ir_min_ = std::min(std::min(m0[1], m1[1]), m2[1]);
+      float ir_max_ = std::max(std::max(m0[1], m1[1]), m2[1]);
 
-        float ir_min_ = std::min(std::min(m0[1], m1[1]), m2[1]);
-        float ir_max_ = std::max(std::max(m0[1], m1[1]), m2[1]);
+      float ir_x = slope_positive ? ir_min_ : ir_max_;
 
-        float ir_x = slope_positive ? ir_min_ : ir_max_;
+      ir_x = FastMath ? fastLog(ir_x) : std::log(ir_x);
+      ir_x = (ir_x * params.ab_confidence_slope * 0.301030f + params.ab_confidence_offset) * 3.321928f;
+      ir_x = FastMath ? fastExp(ir_x) : std::exp(ir_x);
+      ir_x = std::min(params.max_dealias_confidence, std::max(params.min_dealias_confidence, ir_x));
+      ir_x *= ir_x;
 
-        ir_x = std::log(ir_x);
-        ir_x = (ir_x * params.ab_confidence_slope * 0.301030f + params.ab_confidence_offset) * 3.321928f;
-        ir_x = std::exp(ir_x);
-        ir_x = std::min(params.max_dealias_confidence, std::max(params.min_dealias_confidence, ir_x));
-        ir_x *= ir_x;
+      float mask2 = ir_x >= norm ? 1.0f : 0.0f;
 
-        float mask2 = ir_x >= norm ? 1.0f : 0.0f;
+      float t11 = t10 * mask2;
 
-        float t11 = t10 * mask2;
-
-        float mask3 = params.max_dealias_confidence * params.max_dealias_confidence >= norm ? 1.0f : 0.0f;
-        t10 *= mask3;
-        phase = true/*(modeMask & 2) != 0*/ ? t11 : t10;
-      }
+      // with (modeMask & 2) == 0 the shader would use t10 masked by max_dealias_confidence^2 >= norm instead
+      phase = t11;
     }
 
     // this seems to be the phase to depth mapping :)
@@ -497,7 +795,8 @@ public:
     float depth_linear = zmultiplier * phase;
     float max_depth = phase * params.unambigious_dist * 2;
 
-    bool cond1 = /*(modeMask & 32) != 0*/ true && 0 < depth_linear && 0 < max_depth;
+    // (modeMask & 32) != 0 is implied
+    bool cond1 = 0 < depth_linear && 0 < max_depth;
 
     xmultiplier = (xmultiplier * 90) / (max_depth * max_depth * 8192.0);
 
@@ -522,10 +821,12 @@ public:
     //ir_out[2] = std::min(m2[2] * ab_output_multiplier, 65535.0f);
   }
 
-  void filterPixelStage2(int x, int y, cv::Mat &m, bool max_edge_test_ok, float *depth_out)
+  /**
+   * masked_depth and ir_sum hold the rows y - 1, y and y + 1, the outer ones are not accessed in the first and the last row.
+   */
+  void filterPixelStage2(int x, int y, const float *const masked_depth[3], const float *const ir_sum_rows[3], float raw_depth, bool max_edge_test_ok, float *depth_out)
   {
-    cv::Vec3f &depth_and_ir_sum = m.at<cv::Vec3f>(y, x);
-    float &raw_depth = depth_and_ir_sum.val[0], &ir_sum = depth_and_ir_sum.val[2];
+    const float ir_sum = ir_sum_rows[1][x];
 
     if(raw_depth >= params.min_depth && raw_depth <= params.max_depth)
     {
@@ -543,15 +844,15 @@ public:
           {
             if(yi == 0 && xi == 0) continue;
 
-            cv::Vec3f &other = m.at<cv::Vec3f>(y + yi, x + xi);
+            const float other_ir_sum = ir_sum_rows[1 + yi][x + xi], other_masked_depth = masked_depth[1 + yi][x + xi];
 
-            ir_sum_acc += other.val[2];
-            squared_ir_sum_acc += other.val[2] * other.val[2];
+            ir_sum_acc += other_ir_sum;
+            squared_ir_sum_acc += other_ir_sum * other_ir_sum;
 
-            if(0.0f < other.val[1])
+            if(0.0f < other_masked_depth)
             {
-              min_depth = std::min(min_depth, other.val[1]);
-              max_depth = std::max(max_depth, other.val[1]);
+              min_depth = std::min(min_depth, other_masked_depth);
+              max_depth = std::max(max_depth, other_masked_depth);
             }
           }
         }
@@ -587,8 +888,7 @@ public:
           }
           else
           {
-            *depth_out = !max_edge_test_ok ? 0.0f : raw_depth;
-            *depth_out = true ? *depth_out : raw_depth;
+            *depth_out = 0.0f;
           }
         }
       }
@@ -597,12 +897,321 @@ public:
     {
       *depth_out = 0.0f;
     }
+  }
+
+  void processRowStage1(int y, const MeasurementRow &out)
+  {
+    int16_t raw[9][512];
 
-    // override raw depth
-    depth_and_ir_sum.val[0] = depth_and_ir_sum.val[1];
+    for(int sub = 0; sub < 9; ++sub)
+    {
+      decodeMeasurementRow(packet_data, lut11to16, sub, y, raw[sub]);
+    }
+
+    for(int x = 0; x < 512; ++x)
+    {
+      processPixelStage1(x, y, raw, out);
+    }
+  }
+
+  void filterRowStage1(int y, const ConstMeasurementRow rows[3], const MeasurementRow &out, unsigned char *max_edge_test)
+  {
+    for(int x = 0; x < 512; ++x)
+    {
+      bool max_edge_test_val = true;
+      filterPixelStage1(x, y, rows, out, max_edge_test_val);
+      max_edge_test[x] = max_edge_test_val ? 1 : 0;
+    }
+  }
+
+  /**
+   * With the edge aware filter enabled the depth is written to raw_depth, masked_depth and ir_sum for filterRowStage2,
+   * otherwise directly to depth_out.
+   */
+  template<bool EdgeFilter, bool FastMath>
+  void processRowStage2(int y, const ConstMeasurementRow &in, const unsigned char *max_edge_test, float *ir_out, float *depth_out, float *raw_depth, float *masked_depth, float *ir_sum)
+  {
+    // stage 2 transforms its measurements in place, so gather each pixel into local storage
+    float m0[3], m1[3], m2[3];
+
+    for(int x = 0; x < 512; ++x)
+    {
+      m0[0] = in.a[0][x]; m0[1] = in.b[0][x]; m0[2] = in.n[0][x];
+      m1[0] = in.a[1][x]; m1[1] = in.b[1][x]; m1[2] = in.n[1][x];
+      m2[0] = in.a[2][x]; m2[1] = in.b[2][x]; m2[2] = in.n[2][x];
+
+      if(EdgeFilter)
+      {
+        processPixelStage2<FastMath>(x, y, m0, m1, m2, ir_out + x, raw_depth + x, ir_sum + x);
+
+        masked_depth[x] = max_edge_test[x] == 1 ? raw_depth[x] : 0;
+      }
+      else
+      {
+        processPixelStage2<FastMath>(x, y, m0, m1, m2, ir_out + x, depth_out + x, 0);
+      }
+    }
+  }
+
+  void filterRowStage2(int y, const float *const masked_depth[3], const float *const ir_sum[3], const float *raw_depth, const unsigned char *max_edge_test, float *depth_out)
+  {
+    for(int x = 0; x < 512; ++x)
+    {
+      filterPixelStage2(x, y, masked_depth, ir_sum, raw_depth[x], max_edge_test[x] == 1, depth_out + x);
+    }
+  }
+
+  void processRowsStage1(size_t, int y_begin, int y_end)
+  {
+    for(int y = y_begin; y < y_end; ++y)
+    {
+      processRowStage1(y, measurementRow(m, y));
+    }
+  }
+
+  void filterRowsStage1(size_t, int y_begin, int y_end)
+  {
+    for(int y = y_begin; y < y_end; ++y)
+    {
+      ConstMeasurementRow rows[3] = {
+        constMeasurementRow(m, std::max(y - 1, 0)),
+        constMeasurementRow(m, y),
+        constMeasurementRow(m, std::min(y + 1, 423))
+      };
+
+      filterRowStage1(y, rows, measurementRow(m_filtered, y), m_max_edge_test.ptr<unsigned char>(y));
+    }
+  }
+
+  template<bool EdgeFilter, bool FastMath>
+  void processRowsStage2(size_t, int y_begin, int y_end)
+  {
+    for(int y = y_begin; y < y_end; ++y)
+    {
+      if(EdgeFilter)
+      {
+        processRowStage2<true, FastMath>(y, constMeasurementRow(*stage2_input, y), maxEdgeTestRow(y), out_ir.ptr<float>(423 - y), 0,
+            raw_depth_plane.ptr<float>(y), masked_depth_plane.ptr<float>(y), ir_sum_plane.ptr<float>(y));
+      }
+      else
+      {
+        processRowStage2<false, FastMath>(y, constMeasurementRow(*stage2_input, y), 0, out_ir.ptr<float>(423 - y), out_depth.ptr<float>(423 - y), 0, 0, 0);
+      }
+    }
+  }
+
+  void filterRowsStage2(size_t, int y_begin, int y_end)
+  {
+    for(int y = y_begin; y < y_end; ++y)
+    {
+      const int y_prev = std::max(y - 1, 0), y_next = std::min(y + 1, 423);
+      const float *masked_depth[3] = { masked_depth_plane.ptr<float>(y_prev), masked_depth_plane.ptr<float>(y), masked_depth_plane.ptr<float>(y_next) };
+      const float *ir_sum[3] = { ir_sum_plane.ptr<float>(y_prev), ir_sum_plane.ptr<float>(y), ir_sum_plane.ptr<float>(y_next) };
+
+      filterRowStage2(y, masked_depth, ir_sum, raw_depth_plane.ptr<float>(y), maxEdgeTestRow(y), out_depth.ptr<float>(423 - y));
+    }
+  }
+
+  /**
+   * Computes only the ir image, which is the average amplitude of stage 1 and does not depend on the filters.
+   */
+  void processRowsIrOnly(size_t band, int y_begin, int y_end)
+  {
+    MeasurementRowBuffer &buffer = fused_buffers[band].measurements[0];
+    MeasurementRow row = measurementRow(buffer);
+
+    for(int y = y_begin; y < y_end; ++y)
+    {
+      processRowStage1(y, row);
+
+      float *ir_out = out_ir.ptr<float>(423 - y);
+
+      for(int x = 0; x < 512; ++x)
+      {
+        ir_out[x] = std::min((buffer.n[0][x] + buffer.n[1][x] + buffer.n[2][x]) * 0.3333333f * params.ab_output_multiplier, 65535.0f);
+      }
+    }
+  }
+
+  /**
+   * Runs all stages for the rows of one band, row by row. Stage 1 runs two rows and stage 2 one row ahead
+   * of the edge aware filter, so each row is filtered while its inputs are still in the cache.
+   * The rows a 3x3 filter needs from the neighbouring bands are recomputed instead of shared.
+   */
+  template<bool BilateralFilter, bool EdgeFilter, bool FastMath>
+  void processRowsFused(size_t band, int y_begin, int y_end)
+  {
+    FusedRowBuffers &buffers = fused_buffers[band];
+
+    const int edge_halo = EdgeFilter ? 1 : 0;
+    const int bilateral_halo = BilateralFilter ? 1 : 0;
+    const int stage2_begin = std::max(0, y_begin - edge_halo), stage2_end = std::min(424, y_end + edge_halo);
+    const int stage1_begin = std::max(0, stage2_begin - bilateral_halo), stage1_end = std::min(424, stage2_end + bilateral_halo);
+
+    for(int y = stage1_begin; y < y_end + 1 + edge_halo; ++y)
+    {
+      if(y < stage1_end)
+      {
+        processRowStage1(y, measurementRow(buffers.measurements[y % 3]));
+      }
+
+      const int y2 = y - 1;
+
+      if(y2 >= stage2_begin && y2 < stage2_end)
+      {
+        const int slot = y2 % 3;
+        ConstMeasurementRow stage2_in = constMeasurementRow(buffers.measurements[slot]);
+        const unsigned char *max_edge_test = max_edge_test_passed;
+
+        if(BilateralFilter)
+        {
+          ConstMeasurementRow rows[3] = {
+            constMeasurementRow(buffers.measurements[std::max(y2 - 1, 0) % 3]),
+            stage2_in,
+            constMeasurementRow(buffers.measurements[std::min(y2 + 1, 423) % 3])
+          };
+
+          filterRowStage1(y2, rows, measurementRow(buffers.filtered), buffers.max_edge_test[slot]);
+          stage2_in = constMeasurementRow(buffers.filtered);
+          max_edge_test = buffers.max_edge_test[slot];
+        }
+
+        float *ir_out = y2 >= y_begin && y2 < y_end ? out_ir.ptr<float>(423 - y2) : buffers.ir_halo;
+        float *depth_out = EdgeFilter ? 0 : out_depth.ptr<float>(423 - y2);
+
+        processRowStage2<EdgeFilter, FastMath>(y2, stage2_in, max_edge_test, ir_out, depth_out, buffers.raw_depth[slot], buffers.masked_depth[slot], buffers.ir_sum[slot]);
+      }
+
+      const int y3 = y - 2;
+
+      if(EdgeFilter && y3 >= y_begin && y3 < y_end)
+      {
+        const int slot_prev = std::max(y3 - 1, 0) % 3, slot = y3 % 3, slot_next = std::min(y3 + 1, 423) % 3;
+        const float *masked_depth[3] = { buffers.masked_depth[slot_prev], buffers.masked_depth[slot], buffers.masked_depth[slot_next] };
+        const float *ir_sum[3] = { buffers.ir_sum[slot_prev], buffers.ir_sum[slot], buffers.ir_sum[slot_next] };
+        const unsigned char *max_edge_test = BilateralFilter ? buffers.max_edge_test[slot] : max_edge_test_passed;
+
+        filterRowStage2(y3, masked_depth, ir_sum, buffers.raw_depth[slot], max_edge_test, out_depth.ptr<float>(423 - y3));
+      }
+    }
   }
 };
 
+RowBandWorkerPool::RowBandWorkerPool(CpuDepthPacketProcessorImpl *impl, size_t num_bands) :
+    impl_(impl),
+    num_bands_(num_bands),
+    stage_(0),
+    generation_(0),
+    pending_(0),
+    shutdown_(false)
+{
+  workers_.resize(num_bands_ - 1);
+
+  for(size_t i = 0; i < workers_.size(); ++i)
+  {
+    workers_[i].pool = this;
+    workers_[i].band = i + 1;
+  }
+
+  // start threads after all workers are set up, workers_ must not be resized anymore
+  for(size_t i = 0; i < workers_.size(); ++i)
+  {
+    workers_[i].thread = new libfreenect2::thread(&RowBandWorkerPool::static_execute, &workers_[i]);
+  }
+}
+
+RowBandWorkerPool::~RowBandWorkerPool()
+{
+  {
+    libfreenect2::lock_guard l(mutex_);
+    shutdown_ = true;
+  }
+  work_condition_.notify_all();
+
+  for(size_t i = 0; i < workers_.size(); ++i)
+  {
+    workers_[i].thread->join();
+    delete workers_[i].thread;
+  }
+}
+
+size_t RowBandWorkerPool::numBands() const
+{
+  return num_bands_;
+}
+
+void RowBandWorkerPool::run(StageFunction stage)
+{
+  if(workers_.empty())
+  {
+    runBand(stage, 0);
+    return;
+  }
+
+  {
+    libfreenect2::lock_guard l(mutex_);
+    stage_ = stage;
+    pending_ = workers_.size();
+    ++generation_;
+  }
+  work_condition_.notify_all();
+
+  runBand(stage, 0);
+
+  libfreenect2::unique_lock l(mutex_);
+
+  while(pending_ > 0)
+  {
+    WAIT_CONDITION(done_condition_, mutex_, l);
+  }
+}
+
+void RowBandWorkerPool::runBand(StageFunction stage, size_t band)
+{
+  int y_begin = int(424 * band / num_bands_);
+  int y_end = int(424 * (band + 1) / num_bands_);
+
+  (impl_->*stage)(band, y_begin, y_end);
+}
+
+void RowBandWorkerPool::static_execute(void *data)
+{
+  Worker *worker = static_cast<Worker *>(data);
+  worker->pool->execute(worker->band);
+}
+
+void RowBandWorkerPool::execute(size_t band)
+{
+  size_t generation = 0;
+
+  for(;;)
+  {
+    StageFunction stage;
+
+    {
+      libfreenect2::unique_lock l(mutex_);
+
+      while(!shutdown_ && generation_ == generation)
+      {
+        WAIT_CONDITION(work_condition_, mutex_, l);
+      }
+
+      if(shutdown_) return;
+
+      generation = generation_;
+      stage = stage_;
+    }
+
+    runBand(stage, band);
+
+    {
+      libfreenect2::lock_guard l(mutex_);
+      --pending_;
+    }
+    done_condition_.notify_one();
+  }
+}
+
 CpuDepthPacketProcessor::CpuDepthPacketProcessor() :
     impl_(new CpuDepthPacketProcessorImpl())
 {
@@ -621,6 +1230,15 @@ void CpuDepthPacketProcessor::setConfiguration(const libfreenect2::DepthPacketPr
   impl_->params.max_depth = config.MaxDepth * 1000.0f;
   impl_->enable_bilateral_filter = config.EnableBilateralFilter;
   impl_->enable_edge_filter = config.EnableEdgeAwareFilter;
+  impl_->enable_fused_pipeline = config.EnableFusedPipeline;
+  impl_->selectStageFunctions();
+  impl_->setNumThreads(config.NumThreads);
+}
+
+void CpuDepthPacketProcessor::setFastMath(bool enabled)
+{
+  impl_->enable_fast_math = enabled;
+  impl_->selectStageFunctions();
 }
 
 void CpuDepthPacketProcessor::loadP0TablesFromCommandResponse(unsigned char* buffer, size_t buffer_length)
@@ -741,87 +1359,72 @@ void CpuDepthPacketProcessor::process(const DepthPacket &packet)
 {
   if(listener_ == 0) return;
 
+  unsigned int frame_types = listener_->subscribedFrameTypes();
+  bool want_ir = (frame_types & Frame::Ir) != 0, want_depth = (frame_types & Frame::Depth) != 0;
+
+  if(!want_ir && !want_depth) return;
+
   impl_->startTiming();
 
   impl_->ir_frame->timestamp = packet.timestamp;
   impl_->depth_frame->timestamp = packet.timestamp;
   impl_->ir_frame->sequence = packet.sequence;
   impl_->depth_frame->sequence = packet.sequence;
+  impl_->ir_frame->trace = packet.trace;
+  impl_->ir_frame->trace.mark(FrameTrace::ProcessingStart);
 
-  cv::Mat m = cv::Mat::zeros(424, 512, CV_32FC(9)), m_filtered = cv::Mat::zeros(424, 512, CV_32FC(9)), m_max_edge_test = cv::Mat::ones(424, 512, CV_8UC1);
+  impl_->packet_data = packet.buffer;
+  impl_->out_ir = cv::Mat(424, 512, CV_32FC1, impl_->ir_frame->data);
+  impl_->out_depth = cv::Mat(424, 512, CV_32FC1, impl_->depth_frame->data);
 
-  float *m_ptr = m.ptr<float>();
-
-  for(int y = 0; y < 424; ++y)
-    for(int x = 0; x < 512; ++x, m_ptr += 9)
-    {
-      impl_->processPixelStage1(x, y, packet.buffer, m_ptr + 0, m_ptr + 3, m_ptr + 6);
-    }
-
-  // bilateral filtering
-  if(impl_->enable_bilateral_filter)
+  if(!want_depth)
   {
-    float *m_filtered_ptr = m_filtered.ptr<float>();
-    unsigned char *m_max_edge_test_ptr = m_max_edge_test.ptr<unsigned char>();
-
-    for(int y = 0; y < 424; ++y)
-      for(int x = 0; x < 512; ++x, m_filtered_ptr += 9, ++m_max_edge_test_ptr)
-      {
-        bool max_edge_test_val = true;
-        impl_->filterPixelStage1(x, y, m, m_filtered_ptr, max_edge_test_val);
-        *m_max_edge_test_ptr = max_edge_test_val ? 1 : 0;
-      }
-
-    m_ptr = m_filtered.ptr<float>();
+    impl_->workers->run(&CpuDepthPacketProcessorImpl::processRowsIrOnly);
   }
-  else
+  else if(impl_->enable_fused_pipeline)
   {
-    m_ptr = m.ptr<float>();
+    impl_->workers->run(impl_->rows_fused);
   }
-
-  cv::Mat out_ir(424, 512, CV_32FC1, impl_->ir_frame->data), out_depth(424, 512, CV_32FC1, impl_->depth_frame->data);
-
-  if(impl_->enable_edge_filter)
+  else
   {
-    cv::Mat depth_ir_sum(424, 512, CV_32FC3);
-    cv::Vec3f *depth_ir_sum_ptr = depth_ir_sum.ptr<cv::Vec3f>();
-    unsigned char *m_max_edge_test_ptr = m_max_edge_test.ptr<unsigned char>();
-
-    for(int y = 0; y < 424; ++y)
-      for(int x = 0; x < 512; ++x, m_ptr += 9, ++m_max_edge_test_ptr, ++depth_ir_sum_ptr)
-      {
-        float raw_depth, ir_sum;
+    impl_->allocateFullFrameBuffers();
 
-        impl_->processPixelStage2(x, y, m_ptr + 0, m_ptr + 3, m_ptr + 6, out_ir.ptr<float>(423 - y, x), &raw_depth, &ir_sum);
+    impl_->workers->run(&CpuDepthPacketProcessorImpl::processRowsStage1);
 
-        depth_ir_sum_ptr->val[0] = raw_depth;
-        depth_ir_sum_ptr->val[1] = *m_max_edge_test_ptr == 1 ? raw_depth : 0;
-        depth_ir_sum_ptr->val[2] = ir_sum;
-      }
+    // bilateral filtering
+    if(impl_->enable_bilateral_filter)
+    {
+      impl_->workers->run(&CpuDepthPacketProcessorImpl::filterRowsStage1);
+      impl_->stage2_input = &impl_->m_filtered;
+    }
+    else
+    {
+      impl_->stage2_input = &impl_->m;
+    }
 
-    m_max_edge_test_ptr = m_max_edge_test.ptr<unsigned char>();
+    impl_->workers->run(impl_->rows_stage2);
 
-    for(int y = 0; y < 424; ++y)
-      for(int x = 0; x < 512; ++x, ++m_max_edge_test_ptr)
-      {
-        impl_->filterPixelStage2(x, y, depth_ir_sum, *m_max_edge_test_ptr == 1, out_depth.ptr<float>(423 - y, x));
-      }
-  }
-  else
-  {
-    for(int y = 0; y < 424; ++y)
-      for(int x = 0; x < 512; ++x, m_ptr += 9)
-      {
-        impl_->processPixelStage2(x, y, m_ptr + 0, m_ptr + 3, m_ptr + 6, out_ir.ptr<float>(423 - y, x), out_depth.ptr<float>(423 - y, x), 0);
-      }
+    if(impl_->enable_edge_filter)
+    {
+      impl_->workers->run(&CpuDepthPacketProcessorImpl::filterRowsStage2);
+    }
   }
 
-  if(listener_->onNewFrame(Frame::Ir, impl_->ir_frame))
+  impl_->ir_frame->trace.mark(FrameTrace::ProcessingEnd);
+  impl_->depth_frame->trace = impl_->ir_frame->trace;
+
+  if(want_ir)
+    impl_->ir_frame->trace.mark(FrameTrace::ListenerDelivery);
+
+  if(want_ir && listener_->onNewFrame(Frame::Ir, impl_->ir_frame))
   {
     impl_->newIrFrame();
   }
 
-  if(listener_->onNewFrame(Frame::Depth, impl_->depth_frame))
+  if(want_depth)
+    impl_->depth_frame->trace.mark(FrameTrace::ListenerDelivery);
+
+  if(want_depth && listener_->onNewFrame(Frame::Depth, impl_->depth_frame))
   {
     impl_->newDepthFrame();
   }
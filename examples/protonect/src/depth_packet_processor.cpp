@@ -34,7 +34,9 @@ DepthPacketProcessor::Config::Config() :
   MinDepth(0.5f),
   MaxDepth(4.5f),
   EnableBilateralFilter(true),
-  EnableEdgeAwareFilter(true)
+  EnableEdgeAwareFilter(true),
+  NumThreads(1),
+  EnableFusedPipeline(false)
 {
 
 }
@@ -31,24 +31,34 @@
 namespace libfreenect2
 {
 
-DepthPacketStreamParser::DepthPacketStreamParser() :
+DepthPacketStreamParser::DepthPacketStreamParser(size_t num_buffers) :
     processor_(noopProcessor<DepthPacket>()),
+    sub_image_length_(512*424*11/8),
+    slot_(0),
+    slot_length_(0),
+    footer_magic_known_(false),
+    footer_magic0_(0),
+    footer_magic1_(0),
     current_sequence_(0),
-    current_subsequence_(0)
+    current_subsequence_(0),
+    current_timestamp_(0),
+    required_sub_images_(0x1ff),
+    received_bytes_(0),
+    completed_frames_(0),
+    dropped_busy_(0),
+    dropped_incomplete_(0),
+    dropped_invalid_(0),
+    missing_subsequences_(0),
+    last_missing_subsequences_(0)
 {
-  size_t single_image = 512*424*11/8;
-
-  buffer_.allocate((single_image) * 10);
-  buffer_.front().length = buffer_.front().capacity;
-  buffer_.back().length = buffer_.back().capacity;
-
-  work_buffer_.data = new unsigned char[single_image];
-  work_buffer_.capacity = single_image;
-  work_buffer_.length = 0;
+  buffer_.allocate(num_buffers < 2 ? 2 : num_buffers, sub_image_length_ * 10);
+  current_ = buffer_.acquire();
+  current_->length = current_->capacity;
 }
 
 DepthPacketStreamParser::~DepthPacketStreamParser()
 {
+  current_->release();
 }
 
 void DepthPacketStreamParser::setPacketProcessor(libfreenect2::BaseDepthPacketProcessor *processor)
@@ -56,94 +66,228 @@ void DepthPacketStreamParser::setPacketProcessor(libfreenect2::BaseDepthPacketPr
   processor_ = (processor != 0) ? processor : noopProcessor<DepthPacket>();
 }
 
+void DepthPacketStreamParser::setRequiredSubImages(uint32_t mask)
+{
+  required_sub_images_ = mask & 0x3ff;
+}
+
+ParserStatistics DepthPacketStreamParser::statistics() const
+{
+  ParserStatistics s;
+  s.bytes = received_bytes_.load();
+  s.frames = completed_frames_.load();
+  s.dropped_busy = dropped_busy_.load();
+  s.dropped_incomplete = dropped_incomplete_.load();
+  s.dropped_invalid = dropped_invalid_.load();
+  s.missing_subsequences = missing_subsequences_.load();
+  s.last_missing_subsequences = last_missing_subsequences_.load();
+  return s;
+}
+
+bool DepthPacketStreamParser::isFooter(const DepthSubPacketFooter &footer, bool expected)
+{
+  if(footer.length != sub_image_length_ || footer.subsequence >= 10)
+    return false;
+
+  if(footer_magic_known_)
+    return footer.magic0 == footer_magic0_ && footer.magic1 == footer_magic1_;
+
+  // until a footer was seen where the sub image size puts it, nothing else is trusted
+  if(expected)
+  {
+    footer_magic_known_ = true;
+    footer_magic0_ = footer.magic0;
+    footer_magic1_ = footer.magic1;
+  }
+
+  return expected;
+}
+
 void DepthPacketStreamParser::onDataReceived(unsigned char* buffer, size_t in_length)
 {
-  Buffer &wb = work_buffer_;
+  received_bytes_.fetch_add(in_length);
 
   if(in_length == 0)
   {
     //synchronize to subpacket boundary
-    wb.length = 0;
+    slot_length_ = 0;
+    return;
   }
-  else
+
+  // sub images start with a new iso packet and end with one carrying the footer at its end, so
+  // after lost data the next boundary is found by checking the end of every packet
+  DepthSubPacketFooter *footer = 0;
+
+  if(in_length >= sizeof(DepthSubPacketFooter))
   {
-    DepthSubPacketFooter *footer = 0;
-    bool footer_found = false;
+    DepthSubPacketFooter *candidate = reinterpret_cast<DepthSubPacketFooter *>(&buffer[in_length - sizeof(DepthSubPacketFooter)]);
+    bool expected = slot_length_ + in_length == sub_image_length_ + sizeof(DepthSubPacketFooter);
 
-    if(wb.length + in_length == wb.capacity + sizeof(DepthSubPacketFooter))
+    if(isFooter(*candidate, expected))
     {
+      footer = candidate;
       in_length -= sizeof(DepthSubPacketFooter);
-      footer = reinterpret_cast<DepthSubPacketFooter *>(&buffer[in_length]);
-      footer_found = true;
     }
+  }
+
+  // the subsequence number is only known once the footer arrived, so write to the predicted slot
+  unsigned char *slot_data = current_->data + slot_ * sub_image_length_;
 
-    if(wb.length + in_length > wb.capacity)
+  if(slot_length_ + in_length > sub_image_length_)
+  {
+    if(in_length > sub_image_length_)
     {
       std::cerr << "[DepthPacketStreamParser::onDataReceived] subpacket too large" << std::endl;
-      wb.length = 0;
+      slot_length_ = 0;
       return;
     }
 
-    memcpy(wb.data + wb.length, buffer, in_length);
-    wb.length += in_length;
+    // the footer of the previous sub image was lost, this packet starts the next one. it must
+    // not go to a slot which already holds a sub image of the current packet
+    std::cerr << "[DepthPacketStreamParser::onDataReceived] subpacket too large, footer lost" << std::endl;
 
-    if(footer_found)
+    do
     {
-      if(footer->length != wb.length)
-      {
-        std::cerr << "[DepthPacketStreamParser::onDataReceived] image data too short!" << std::endl;
-      }
-      else
-      {
-        if(current_sequence_ != footer->sequence)
-        {
-          if(current_subsequence_ == 0x3ff)
-          {
-            if(processor_->ready())
-            {
-              buffer_.swap();
-
-              DepthPacket packet;
-              packet.sequence = current_sequence_;
-              packet.timestamp = footer->timestamp;
-              packet.buffer = buffer_.back().data;
-              packet.buffer_length = buffer_.back().length;
-
-              processor_->process(packet);
-            }
-            else
-            {
-              std::cerr << "[DepthPacketStreamParser::onDataReceived] skipping depth packet" << std::endl;
-            }
-          }
-          else
-          {
-            std::cerr << "[DepthPacketStreamParser::onDataReceived] not all subsequences received " << current_subsequence_ << std::endl;
-          }
-
-          current_sequence_ = footer->sequence;
-          current_subsequence_ = 0;
-        }
-
-        Buffer &fb = buffer_.front();
-
-        // set the bit corresponding to the subsequence number to 1
-        current_subsequence_ |= 1 << footer->subsequence;
-
-        if(footer->subsequence * footer->length > fb.length)
-        {
-          std::cerr << "[DepthPacketStreamParser::onDataReceived] front buffer too short! subsequence number is " << footer->subsequence << std::endl;
-        }
-        else
-        {
-          memcpy(fb.data + (footer->subsequence * footer->length), wb.data + (wb.length - footer->length), footer->length);
-        }
-      }
-
-      // reset working buffer
-      wb.length = 0;
+      slot_ = (slot_ + 1) % 10;
     }
+    while(current_subsequence_ & (1 << slot_));
+
+    slot_data = current_->data + slot_ * sub_image_length_;
+    slot_length_ = 0;
+  }
+
+  if(current_subsequence_ == 0 && slot_length_ == 0)
+  {
+    current_trace_.mark(FrameTrace::FirstTransfer);
+  }
+
+  memcpy(slot_data + slot_length_, buffer, in_length);
+  slot_length_ += in_length;
+
+  if(footer == 0)
+    return;
+
+  bool valid = footer->length == slot_length_;
+
+  if(!valid)
+  {
+    std::cerr << "[DepthPacketStreamParser::onDataReceived] image data too short!" << std::endl;
   }
+
+  // the next sub image starts after the footer, even if this one is incomplete
+  slot_length_ = 0;
+
+  onSubImage(*footer, valid ? slot_data : 0);
+}
+
+void DepthPacketStreamParser::onSubImage(const DepthSubPacketFooter &footer, unsigned char *data)
+{
+  if(current_sequence_ != footer.sequence)
+  {
+    // the end of the previous packet was lost, this sub image was written to one of its free slots
+    if(current_subsequence_ != 0)
+    {
+      finishPacket(data, footer.subsequence);
+
+      // the start of this sub image went to the previous packet
+      current_trace_.mark(FrameTrace::FirstTransfer);
+    }
+
+    current_sequence_ = footer.sequence;
+    current_subsequence_ = 0;
+  }
+
+  if(data != 0)
+  {
+    unsigned char *slot_data = current_->data + footer.subsequence * sub_image_length_;
+
+    if(data != slot_data)
+    {
+      // a sub image was lost, move the data to its actual slot
+      memmove(slot_data, data, sub_image_length_);
+    }
+
+    // set the bit corresponding to the subsequence number to 1
+    current_subsequence_ |= 1 << footer.subsequence;
+    current_timestamp_ = footer.timestamp;
+    current_trace_.mark(FrameTrace::LastTransfer);
+  }
+
+  slot_ = (footer.subsequence + 1) % 10;
+
+  if(footer.subsequence == 9 || current_subsequence_ == 0x3ff)
+  {
+    unsigned char *no_carry = 0;
+    finishPacket(no_carry, 0);
+  }
+}
+
+void DepthPacketStreamParser::finishPacket(unsigned char *&carry, uint32_t carry_subsequence)
+{
+  uint32_t received = current_subsequence_;
+  current_subsequence_ = 0;
+
+  FrameTrace trace = current_trace_;
+  current_trace_ = FrameTrace();
+
+  if(received != 0x3ff)
+  {
+    size_t missing = ~received & 0x3ff;
+    missing_subsequences_.store(missing_subsequences_.load() | missing);
+    last_missing_subsequences_.store(missing);
+
+    if(received == 0 || (received & required_sub_images_) != required_sub_images_)
+    {
+      std::cerr << "[DepthPacketStreamParser::onDataReceived] not all subsequences received " << received << std::endl;
+      dropped_incomplete_.fetch_add(1);
+      return;
+    }
+  }
+
+  // a refusal is counted by the processor queue
+  if(!processor_->ready())
+    return;
+
+  // the processor may keep the buffer, so the next packet has to go to a free one
+  PacketBuffer *next = buffer_.acquire();
+
+  if(next == 0)
+  {
+    std::cerr << "[DepthPacketStreamParser::onDataReceived] skipping depth packet, no free buffer" << std::endl;
+    dropped_busy_.fetch_add(1);
+    return;
+  }
+
+  next->length = next->capacity;
+
+  if(carry != 0)
+  {
+    unsigned char *carry_slot = next->data + carry_subsequence * sub_image_length_;
+    memcpy(carry_slot, carry, sub_image_length_);
+    carry = carry_slot;
+  }
+
+  for(uint32_t i = 0; received != 0x3ff && i < 10; ++i)
+  {
+    if((received & (1 << i)) == 0)
+      memset(current_->data + i * sub_image_length_, 0, sub_image_length_);
+  }
+
+  DepthPacket packet;
+  packet.sequence = current_sequence_;
+  packet.timestamp = current_timestamp_;
+  packet.buffer = current_->data;
+  packet.buffer_length = current_->length;
+  packet.valid_sub_images = received;
+  packet.memory = current_;
+  packet.trace = trace;
+  packet.trace.mark(FrameTrace::ParserCommit);
+
+  processor_->process(packet);
+  completed_frames_.fetch_add(1);
+
+  current_->release();
+  current_ = next;
 }
 
 } /* namespace libfreenect2 */
@@ -25,33 +25,219 @@
  */
 
 #include <libfreenect2/frame_listener_impl.h>
+#include <libfreenect2/frame_pool.h>
 #include <libfreenect2/threading.h>
+#include <libfreenect2/packet_handoff.h>
+#include <libfreenect2/frame_trace.h>
+#include <vector>
 
 namespace libfreenect2
 {
 
+Frame::Frame(size_t width, size_t height, size_t bytes_per_pixel) :
+  width(width),
+  height(height),
+  bytes_per_pixel(bytes_per_pixel),
+  pool_(0)
+{
+  data = new unsigned char[width * height * bytes_per_pixel];
+}
+
+Frame::Frame(size_t width, size_t height, size_t bytes_per_pixel, unsigned char *data, FramePool *pool) :
+  width(width),
+  height(height),
+  bytes_per_pixel(bytes_per_pixel),
+  data(data),
+  pool_(pool)
+{
+  if(this->data == 0)
+    this->data = new unsigned char[width * height * bytes_per_pixel];
+}
+
+Frame::~Frame()
+{
+  if(pool_ != 0)
+    pool_->recycle(data);
+  else
+    delete[] data;
+}
+
 FrameListener::~FrameListener() {}
 
+unsigned int FrameListener::subscribedFrameTypes() const
+{
+  return Frame::Color | Frame::Ir | Frame::Depth;
+}
+
 class SyncMultiFrameListenerImpl
 {
 public:
   libfreenect2::mutex mutex_;
   libfreenect2::condition_variable condition_;
+  // signaled when the consumer took the frames, producers wait on it with the Block policy
+  libfreenect2::condition_variable taken_;
   FrameMap next_frame_;
 
   const unsigned int subscribed_frame_types_;
   unsigned int ready_frame_types_;
 
+  // indexed by typeIndex()
+  BackpressurePolicy policy_[3];
+  BackpressureCounters counters_[3];
+
+  bool latency_histogram_enabled_;
+  LatencyHistogram latency_histogram_[3];
+
+  // timestamp sync is enabled if sync_history_ is not 0, frames wait in history_ for their partners
+  size_t sync_history_;
+  uint32_t sync_window_;
+  // reserved to sync_history_ + 1 entries, so the steady state does not allocate
+  std::vector<Frame *> history_[3];
+  size_t matched_sets_;
+  size_t unmatched_[3];
+
+  // signaled when a frame set gets ready, after getNotificationFd() was called
+  WakeupEvent notification_;
+  bool notification_enabled_;
+
   SyncMultiFrameListenerImpl(unsigned int frame_types) :
     subscribed_frame_types_(frame_types),
-    ready_frame_types_(0)
+    ready_frame_types_(0),
+    latency_histogram_enabled_(false),
+    sync_history_(0),
+    sync_window_(0),
+    matched_sets_(0),
+    notification_enabled_(false)
+  {
+    for(size_t i = 0; i < 3; ++i)
+    {
+      policy_[i] = BackpressurePolicy(BackpressurePolicy::DropOldest);
+      unmatched_[i] = 0;
+    }
+  }
+
+  ~SyncMultiFrameListenerImpl()
+  {
+    for(size_t i = 0; i < 3; ++i)
+      discard(i, history_[i].size());
+
+    for(size_t i = 0; i < 3; ++i)
+      delete next_frame_[indexType(i)];
+  }
+
+  /** needs mutex_ locked by l, false if the frame of the given type was not taken within timeout seconds */
+  bool waitForTaken(libfreenect2::unique_lock &l, Frame::Type type, double timeout)
+  {
+#ifdef LIBFREENECT2_THREADING_STDLIB
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() +
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(timeout));
+
+    while(next_frame_[type] != 0)
+    {
+      if(taken_.wait_until(l, deadline) == std::cv_status::timeout)
+        return next_frame_[type] == 0;
+    }
+#else
+    // tinythread has no timed wait
+    for(double start = FrameTrace::now(); next_frame_[type] != 0;)
+    {
+      if(FrameTrace::now() - start >= timeout)
+        return false;
+
+      mutex_.unlock();
+      libfreenect2::this_thread::sleep_for(libfreenect2::chrono::milliseconds(1));
+      mutex_.lock();
+    }
+#endif
+    return true;
+  }
+
+  void discard(size_t idx, size_t n)
+  {
+    for(size_t i = 0; i < n; ++i)
+      delete history_[idx][i];
+
+    history_[idx].erase(history_[idx].begin(), history_[idx].begin() + n);
+    unmatched_[idx] += n;
+  }
+
+  /** looks for the newest set of frames within the window, makes it the next frame set and discards older frames */
+  bool matchTimestamps()
+  {
+    size_t types[3], n = 0, count[3] = { 1, 1, 1 };
+
+    for(size_t i = 0; i < 3; ++i)
+    {
+      if((subscribed_frame_types_ & indexType(i)) == 0) continue;
+      if(history_[i].empty()) return false;
+
+      types[n] = i;
+      count[n] = history_[i].size();
+      ++n;
+    }
+
+    for(size_t a = count[0]; a-- > 0;)
+    {
+      for(size_t b = count[1]; b-- > 0;)
+      {
+        for(size_t c = count[2]; c-- > 0;)
+        {
+          size_t pos[3] = { a, b, c };
+          uint32_t reference = history_[types[0]][a]->timestamp;
+          int32_t lowest = 0, highest = 0;
+
+          // the device timestamps wrap around, so compare differences
+          for(size_t k = 1; k < n; ++k)
+          {
+            int32_t d = (int32_t)(history_[types[k]][pos[k]]->timestamp - reference);
+            if(d < lowest) lowest = d;
+            if(d > highest) highest = d;
+          }
+
+          if((uint32_t)(highest - lowest) > sync_window_) continue;
+
+          for(size_t k = 0; k < n; ++k)
+          {
+            size_t idx = types[k];
+            Frame::Type type = indexType(idx);
+
+            discard(idx, pos[k]);
+
+            if(next_frame_[type] != 0)
+            {
+              // the previous set was not consumed
+              delete next_frame_[type];
+              counters_[idx].dropped_oldest += 1;
+            }
+
+            next_frame_[type] = history_[idx].front();
+            history_[idx].erase(history_[idx].begin());
+            ready_frame_types_ |= type;
+          }
+
+          matched_sets_ += 1;
+          return true;
+        }
+      }
+    }
+
+    return false;
+  }
+
+  static Frame::Type indexType(size_t idx)
   {
+    return idx == 0 ? Frame::Color : (idx == 1 ? Frame::Ir : Frame::Depth);
   }
 
   bool hasNewFrame() const
   {
     return ready_frame_types_ == subscribed_frame_types_;
   }
+
+  static size_t typeIndex(Frame::Type type)
+  {
+    return type == Frame::Color ? 0 : (type == Frame::Ir ? 1 : 2);
+  }
 };
 
 SyncMultiFrameListener::SyncMultiFrameListener(unsigned int frame_types) :
@@ -80,9 +266,10 @@ bool SyncMultiFrameListener::waitForNewFrame(FrameMap &frame, int milliseconds)
 
   if(impl_->condition_.wait_for(l, std::chrono::milliseconds(milliseconds), predicate))
   {
-    frame = impl_->next_frame_;
+    frame.swap(impl_->next_frame_);
     impl_->next_frame_.clear();
     impl_->ready_frame_types_ = 0;
+    impl_->taken_.notify_all();
 
     return true;
   }
@@ -102,43 +289,336 @@ void SyncMultiFrameListener::waitForNewFrame(FrameMap &frame)
     WAIT_CONDITION(impl_->condition_, impl_->mutex_, l)
   }
 
-  frame = impl_->next_frame_;
+  frame.swap(impl_->next_frame_);
   impl_->next_frame_.clear();
   impl_->ready_frame_types_ = 0;
+  impl_->taken_.notify_all();
 }
 
 void SyncMultiFrameListener::release(FrameMap &frame)
 {
-  for(FrameMap::iterator it = frame.begin(); it != frame.end(); ++it)
+  delete frame[Frame::Color];
+  delete frame[Frame::Ir];
+  delete frame[Frame::Depth];
+
+  frame.clear();
+}
+
+unsigned int SyncMultiFrameListener::subscribedFrameTypes() const
+{
+  return impl_->subscribed_frame_types_;
+}
+
+void SyncMultiFrameListener::setBackpressurePolicy(const BackpressurePolicy &policy, unsigned int frame_types)
+{
+  libfreenect2::lock_guard l(impl_->mutex_);
+
+  if(frame_types & Frame::Color) impl_->policy_[0] = policy;
+  if(frame_types & Frame::Ir) impl_->policy_[1] = policy;
+  if(frame_types & Frame::Depth) impl_->policy_[2] = policy;
+}
+
+BackpressureCounters SyncMultiFrameListener::backpressureCounters(Frame::Type type) const
+{
+  libfreenect2::lock_guard l(impl_->mutex_);
+
+  return impl_->counters_[SyncMultiFrameListenerImpl::typeIndex(type)];
+}
+
+class LatestFrameListenerImpl
+{
+public:
+  // the middle slot index and whether the producer put a frame there which the consumer did not take yet
+  static const size_t Fresh = 4;
+
+  struct TripleBuffer
+  {
+    Frame *slots[3];
+    // front is used by the consumer, back by the producer, the other one is shared through middle
+    size_t front, back;
+    libfreenect2::atomic_size_t middle;
+
+    libfreenect2::atomic_size_t waiting;
+    WakeupEvent wakeup;
+
+    TripleBuffer() :
+      front(0),
+      back(1),
+      middle(2),
+      waiting(0)
+    {
+      for(size_t i = 0; i < 3; ++i)
+        slots[i] = 0;
+    }
+
+    ~TripleBuffer()
+    {
+      for(size_t i = 0; i < 3; ++i)
+        delete slots[i];
+    }
+
+    size_t exchangeMiddle(size_t value)
+    {
+      size_t expected = middle.load();
+      while(!middle.compare_exchange_strong(expected, value));
+      return expected;
+    }
+
+    void publish(Frame *frame)
+    {
+      // the back slot holds a frame nobody will look at again
+      delete slots[back];
+      slots[back] = frame;
+      back = exchangeMiddle(back | Fresh) & 3;
+
+      if(waiting.load() != 0)
+        wakeup.notify();
+    }
+
+    Frame *take()
+    {
+      if((middle.load() & Fresh) == 0)
+        return 0;
+
+      front = exchangeMiddle(front) & 3;
+      return slots[front];
+    }
+  };
+
+  const unsigned int subscribed_frame_types_;
+
+  // indexed by SyncMultiFrameListenerImpl::typeIndex()
+  TripleBuffer buffers_[3];
+
+  // signaled for every new frame, after getNotificationFd() was called
+  WakeupEvent notification_;
+  libfreenect2::atomic_size_t notification_enabled_;
+
+  LatestFrameListenerImpl(unsigned int frame_types) :
+    subscribed_frame_types_(frame_types),
+    notification_enabled_(0)
+  {
+  }
+};
+
+LatestFrameListener::LatestFrameListener(unsigned int frame_types) :
+    impl_(new LatestFrameListenerImpl(frame_types))
+{
+}
+
+LatestFrameListener::~LatestFrameListener()
+{
+  delete impl_;
+}
+
+Frame *LatestFrameListener::latestFrame(Frame::Type type)
+{
+  return impl_->buffers_[SyncMultiFrameListenerImpl::typeIndex(type)].take();
+}
+
+Frame *LatestFrameListener::waitForLatestFrame(Frame::Type type)
+{
+  LatestFrameListenerImpl::TripleBuffer &buffer = impl_->buffers_[SyncMultiFrameListenerImpl::typeIndex(type)];
+
+  while(true)
   {
-    delete it->second;
-    it->second = 0;
+    Frame *frame = buffer.take();
+    if(frame != 0) return frame;
+
+    // announce the sleep before checking again, so the producer can not miss it
+    buffer.waiting.store(1);
+
+    if((buffer.middle.load() & LatestFrameListenerImpl::Fresh) == 0)
+      buffer.wakeup.wait();
+
+    buffer.waiting.store(0);
   }
+}
 
-  frame.clear();
+bool LatestFrameListener::onNewFrame(Frame::Type type, Frame *frame)
+{
+  if((impl_->subscribed_frame_types_ & type) == 0) return false;
+
+  impl_->buffers_[SyncMultiFrameListenerImpl::typeIndex(type)].publish(frame);
+
+  if(impl_->notification_enabled_.load() != 0)
+    impl_->notification_.notify();
+
+  return true;
+}
+
+int LatestFrameListener::getNotificationFd()
+{
+  impl_->notification_enabled_.store(1);
+
+  // frames may already be waiting
+  for(size_t i = 0; i < 3; ++i)
+  {
+    if((impl_->buffers_[i].middle.load() & LatestFrameListenerImpl::Fresh) != 0)
+      impl_->notification_.notify();
+  }
+
+  return impl_->notification_.fileDescriptor();
+}
+
+void LatestFrameListener::clearNotification()
+{
+  impl_->notification_.reset();
+}
+
+unsigned int LatestFrameListener::subscribedFrameTypes() const
+{
+  return impl_->subscribed_frame_types_;
+}
+
+void SyncMultiFrameListener::setTimestampSync(uint32_t window, size_t history)
+{
+  libfreenect2::lock_guard l(impl_->mutex_);
+
+  impl_->sync_window_ = window;
+  impl_->sync_history_ = history;
+
+  for(size_t i = 0; i < 3; ++i)
+  {
+    if(impl_->history_[i].size() > history)
+      impl_->discard(i, impl_->history_[i].size() - history);
+
+    impl_->history_[i].reserve(history + 1);
+  }
+}
+
+size_t SyncMultiFrameListener::matchedFrameSets() const
+{
+  libfreenect2::lock_guard l(impl_->mutex_);
+  return impl_->matched_sets_;
+}
+
+size_t SyncMultiFrameListener::unmatchedFrames(Frame::Type type) const
+{
+  libfreenect2::lock_guard l(impl_->mutex_);
+  return impl_->unmatched_[SyncMultiFrameListenerImpl::typeIndex(type)];
+}
+
+int SyncMultiFrameListener::getNotificationFd()
+{
+  libfreenect2::lock_guard l(impl_->mutex_);
+
+  impl_->notification_enabled_ = true;
+
+  // a set may already be waiting
+  if(impl_->hasNewFrame())
+    impl_->notification_.notify();
+
+  return impl_->notification_.fileDescriptor();
+}
+
+void SyncMultiFrameListener::clearNotification()
+{
+  impl_->notification_.reset();
+}
+
+void SyncMultiFrameListener::setLatencyHistogramEnabled(bool enabled)
+{
+  libfreenect2::lock_guard l(impl_->mutex_);
+  impl_->latency_histogram_enabled_ = enabled;
+}
+
+LatencyHistogram SyncMultiFrameListener::latencyHistogram(Frame::Type type) const
+{
+  libfreenect2::lock_guard l(impl_->mutex_);
+
+  return impl_->latency_histogram_[SyncMultiFrameListenerImpl::typeIndex(type)];
 }
 
 bool SyncMultiFrameListener::onNewFrame(Frame::Type type, Frame *frame)
 {
   if((impl_->subscribed_frame_types_ & type) == 0) return false;
 
+  size_t idx = SyncMultiFrameListenerImpl::typeIndex(type);
+  BackpressurePolicy policy;
+  bool timestamp_sync;
+
   {
     libfreenect2::lock_guard l(impl_->mutex_);
+    timestamp_sync = impl_->sync_history_ > 0;
 
-    FrameMap::iterator it = impl_->next_frame_.find(type);
-
-    if(it != impl_->next_frame_.end())
+    if(timestamp_sync)
     {
-      // replace frame
-      delete it->second;
-      it->second = frame;
+      impl_->counters_[idx].accepted += 1;
+
+      if(impl_->latency_histogram_enabled_)
+        impl_->latency_histogram_[idx].add(frame->trace);
+
+      impl_->history_[idx].push_back(frame);
+
+      if(impl_->history_[idx].size() > impl_->sync_history_)
+        impl_->discard(idx, 1);
+
+      if(!impl_->matchTimestamps())
+        return true;
+
+      if(impl_->notification_enabled_)
+        impl_->notification_.notify();
     }
     else
     {
-      impl_->next_frame_[type] = frame;
+      policy = impl_->policy_[idx];
+    }
+  }
+
+  if(timestamp_sync)
+  {
+    impl_->condition_.notify_one();
+    return true;
+  }
+
+  if(policy.type == BackpressurePolicy::Block)
+  {
+    // wait for the consumer to take the previous frame, this thread is the only one adding frames of this type
+    libfreenect2::unique_lock l(impl_->mutex_);
+
+    if(impl_->next_frame_[type] != 0)
+    {
+      impl_->counters_[idx].blocked += 1;
+
+      if(!impl_->waitForTaken(l, type, policy.timeout))
+      {
+        impl_->counters_[idx].timed_out += 1;
+        impl_->counters_[idx].dropped_newest += 1;
+        return false;
+      }
+    }
+  }
+
+  {
+    libfreenect2::lock_guard l(impl_->mutex_);
+
+    Frame *&next = impl_->next_frame_[type];
+
+    if(next != 0)
+    {
+      if(policy.type == BackpressurePolicy::DropNewest)
+      {
+        // keep the unconsumed frame, the processor reuses the new one
+        impl_->counters_[idx].dropped_newest += 1;
+        return false;
+      }
+
+      // replace frame
+      delete next;
+      impl_->counters_[idx].dropped_oldest += 1;
     }
 
+    next = frame;
+
     impl_->ready_frame_types_ |= type;
+    impl_->counters_[idx].accepted += 1;
+
+    if(impl_->latency_histogram_enabled_)
+      impl_->latency_histogram_[idx].add(frame->trace);
+
+    if(impl_->notification_enabled_ && impl_->hasNewFrame())
+      impl_->notification_.notify();
   }
 
   impl_->condition_.notify_one();
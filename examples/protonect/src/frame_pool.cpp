@@ -0,0 +1,102 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+
+#include <libfreenect2/frame_pool.h>
+
+namespace libfreenect2
+{
+
+FramePool::FramePool(size_t width, size_t height, size_t bytes_per_pixel, size_t max_idle) :
+    width_(width),
+    height_(height),
+    bytes_per_pixel_(bytes_per_pixel),
+    max_idle_(max_idle),
+    references_(1)
+{
+}
+
+FramePool::~FramePool()
+{
+  for(size_t i = 0; i < idle_.size(); ++i)
+    delete[] idle_[i];
+}
+
+Frame *FramePool::allocate()
+{
+  unsigned char *data = 0;
+
+  {
+    libfreenect2::lock_guard guard(mutex_);
+
+    references_ += 1;
+
+    if(!idle_.empty())
+    {
+      data = idle_.back();
+      idle_.pop_back();
+    }
+  }
+
+  return new Frame(width_, height_, bytes_per_pixel_, data, this);
+}
+
+void FramePool::release()
+{
+  bool last;
+
+  {
+    libfreenect2::lock_guard guard(mutex_);
+    references_ -= 1;
+    last = references_ == 0;
+  }
+
+  if(last) delete this;
+}
+
+void FramePool::recycle(unsigned char *data)
+{
+  bool last;
+
+  {
+    libfreenect2::lock_guard guard(mutex_);
+
+    if(idle_.size() < max_idle_)
+    {
+      idle_.push_back(data);
+      data = 0;
+    }
+
+    references_ -= 1;
+    last = references_ == 0;
+  }
+
+  delete[] data;
+
+  if(last) delete this;
+}
+
+} /* namespace libfreenect2 */
@@ -0,0 +1,142 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+
+#include <libfreenect2/frame_trace.h>
+#include <opencv2/opencv.hpp>
+
+namespace libfreenect2
+{
+
+FrameTrace::FrameTrace()
+{
+  for(size_t i = 0; i < NumStages; ++i)
+    time[i] = 0.0;
+}
+
+void FrameTrace::mark(Stage stage)
+{
+  time[stage] = now();
+}
+
+double FrameTrace::latency(Stage from, Stage to) const
+{
+  if(time[from] == 0.0 || time[to] == 0.0) return 0.0;
+
+  return time[to] - time[from];
+}
+
+double FrameTrace::now()
+{
+  return cv::getTickCount() / cv::getTickFrequency();
+}
+
+LatencyHistogram::Bins::Bins() :
+    frames(0),
+    sum(0.0),
+    max(0.0)
+{
+  for(size_t i = 0; i < NumBins; ++i)
+    count[i] = 0;
+}
+
+double LatencyHistogram::Bins::average() const
+{
+  return frames > 0 ? sum / frames : 0.0;
+}
+
+double LatencyHistogram::Bins::percentile(double p) const
+{
+  size_t n = 0;
+
+  for(size_t i = 0; i < NumBins; ++i)
+  {
+    n += count[i];
+
+    if(n > 0 && n >= p * frames)
+      return binUpperBound(i) < max ? binUpperBound(i) : max;
+  }
+
+  return max;
+}
+
+void LatencyHistogram::add(const FrameTrace &trace)
+{
+  int first = -1, previous = -1;
+
+  for(int i = 0; i < FrameTrace::NumStages; ++i)
+  {
+    if(trace.time[i] == 0.0) continue;
+
+    if(previous >= 0)
+      add(stages_[i], trace.time[i] - trace.time[previous]);
+    else
+      first = i;
+
+    previous = i;
+  }
+
+  if(first >= 0 && previous > first)
+    add(total_, trace.time[previous] - trace.time[first]);
+}
+
+void LatencyHistogram::reset()
+{
+  for(size_t i = 0; i < FrameTrace::NumStages; ++i)
+    stages_[i] = Bins();
+
+  total_ = Bins();
+}
+
+const LatencyHistogram::Bins &LatencyHistogram::stage(FrameTrace::Stage stage) const
+{
+  return stages_[stage];
+}
+
+const LatencyHistogram::Bins &LatencyHistogram::total() const
+{
+  return total_;
+}
+
+double LatencyHistogram::binUpperBound(size_t bin)
+{
+  return (double)(size_t(1) << bin) * 1e-6;
+}
+
+void LatencyHistogram::add(Bins &bins, double latency)
+{
+  size_t bin = 0;
+
+  while(bin + 1 < NumBins && latency >= binUpperBound(bin))
+    ++bin;
+
+  bins.count[bin] += 1;
+  bins.frames += 1;
+  bins.sum += latency;
+  if(latency > bins.max) bins.max = latency;
+}
+
+} /* namespace libfreenect2 */
@@ -92,6 +92,7 @@ public:
 
   virtual void setColorFrameListener(libfreenect2::FrameListener* rgb_frame_listener);
   virtual void setIrAndDepthFrameListener(libfreenect2::FrameListener* ir_frame_listener);
+  virtual StreamStatistics getStreamStatistics();
   virtual void start();
   virtual void stop();
   virtual void close();
@@ -335,6 +336,7 @@ Freenect2DeviceImpl::~Freenect2DeviceImpl()
   close();
   context_->removeDevice(this);
 
+  // the parsers give the lent transfer buffers back, so the pipeline goes before the transfer pools
   delete pipeline_;
 }
 
@@ -395,6 +397,16 @@ void Freenect2DeviceImpl::setIrAndDepthFrameListener(libfreenect2::FrameListener
     pipeline_->getDepthPacketProcessor()->setFrameListener(ir_frame_listener);
 }
 
+StreamStatistics Freenect2DeviceImpl::getStreamStatistics()
+{
+  StreamStatistics statistics;
+  statistics.rgb_transfers = rgb_transfer_pool_.statistics();
+  statistics.ir_transfers = ir_transfer_pool_.statistics();
+  statistics.rgb = pipeline_->getRgbParserStatistics();
+  statistics.depth = pipeline_->getIrParserStatistics();
+  return statistics;
+}
+
 bool Freenect2DeviceImpl::open()
 {
   std::cout << "[Freenect2DeviceImpl] opening..." << std::endl;
@@ -421,8 +433,9 @@ bool Freenect2DeviceImpl::open()
     return false;
   }
 
-  rgb_transfer_pool_.allocate(50, 0x4000);
-  ir_transfer_pool_.allocate(80, 8, max_iso_packet_size);
+  // transfer buffers stay lent to the rgb packets until they are decoded, so keep spares
+  if(!rgb_transfer_pool_.allocate(150, 0x4000)) return false;
+  if(!ir_transfer_pool_.allocate(80, 8, max_iso_packet_size)) return false;
 
   state_ = Open;
 
@@ -28,19 +28,16 @@
  * Process pixel stage 1
  ******************************************************************************/
 
-float decodePixelMeasurement(global const ushort *data, global const short *lut11to16, const uint sub, const uint x, const uint y)
+// address is the precomputed word offset within a sub image << 4 | bit shift, or DECODE_INVALID_ADDRESS
+float decodePixelMeasurement(global const ushort *data, global const short *lut11to16, const uint sub, const uint address)
 {
-  uint row_idx = (424 * sub + (y < 212 ? y + 212 : 423 - y)) * 352;
-  uint idx = (((x >> 2) + ((x << 7) & BFI_BITMASK)) * 11) & (uint)0xffffffff;
-
-  uint col_idx = idx >> 4;
-  uint upper_bytes = idx & 15;
+  uint upper_bytes = address & 15;
   uint lower_bytes = 16 - upper_bytes;
 
-  uint data_idx0 = row_idx + col_idx;
-  uint data_idx1 = row_idx + col_idx + 1;
+  uint data_idx0 = 424 * 352 * sub + (address >> 4);
+  uint data_idx1 = data_idx0 + 1;
 
-  return (float)lut11to16[(x < 1 || 510 < x || col_idx > 352) ? 0 : ((data[data_idx0] >> upper_bytes) | (data[data_idx1] << lower_bytes)) & 2047];
+  return (float)lut11to16[address == DECODE_INVALID_ADDRESS ? 0 : ((data[data_idx0] >> upper_bytes) | (data[data_idx1] << lower_bytes)) & 2047];
 }
 
 float2 processMeasurementTriple(const float ab_multiplier_per_frq, const float p0, const float3 v, int *invalid)
@@ -55,14 +52,11 @@ float2 processMeasurementTriple(const float ab_multiplier_per_frq, const float p
 }
 
 void kernel processPixelStage1(global const short *lut11to16, global const float *z_table, global const float3 *p0_table, global const ushort *data,
-                               global float3 *a_out, global float3 *b_out, global float3 *n_out, global float *ir_out)
+                               global const uint *decode_table, global float3 *a_out, global float3 *b_out, global float3 *n_out, global float *ir_out)
 {
   const uint i = get_global_id(0);
 
-  const uint x = i % 512;
-  const uint y = i / 512;
-
-  const uint y_in = (423 - y);
+  const uint address = decode_table[i];
 
   const float zmultiplier = z_table[i];
   int valid = (int)(0.0f < zmultiplier);
@@ -72,19 +66,19 @@ void kernel processPixelStage1(global const short *lut11to16, global const float
   int3 invalid_pixel = (int3)((int)(!valid));
   const float3 p0 = p0_table[i];
 
-  const float3 v0 = (float3)(decodePixelMeasurement(data, lut11to16, 0, x, y_in),
-                             decodePixelMeasurement(data, lut11to16, 1, x, y_in),
-                             decodePixelMeasurement(data, lut11to16, 2, x, y_in));
+  const float3 v0 = (float3)(decodePixelMeasurement(data, lut11to16, 0, address),
+                             decodePixelMeasurement(data, lut11to16, 1, address),
+                             decodePixelMeasurement(data, lut11to16, 2, address));
   const float2 ab0 = processMeasurementTriple(AB_MULTIPLIER_PER_FRQ0, p0.x, v0, &saturatedX);
 
-  const float3 v1 = (float3)(decodePixelMeasurement(data, lut11to16, 3, x, y_in),
-                             decodePixelMeasurement(data, lut11to16, 4, x, y_in),
-                             decodePixelMeasurement(data, lut11to16, 5, x, y_in));
+  const float3 v1 = (float3)(decodePixelMeasurement(data, lut11to16, 3, address),
+                             decodePixelMeasurement(data, lut11to16, 4, address),
+                             decodePixelMeasurement(data, lut11to16, 5, address));
   const float2 ab1 = processMeasurementTriple(AB_MULTIPLIER_PER_FRQ1, p0.y, v1, &saturatedY);
 
-  const float3 v2 = (float3)(decodePixelMeasurement(data, lut11to16, 6, x, y_in),
-                             decodePixelMeasurement(data, lut11to16, 7, x, y_in),
-                             decodePixelMeasurement(data, lut11to16, 8, x, y_in));
+  const float3 v2 = (float3)(decodePixelMeasurement(data, lut11to16, 6, address),
+                             decodePixelMeasurement(data, lut11to16, 7, address),
+                             decodePixelMeasurement(data, lut11to16, 8, address));
   const float2 ab2 = processMeasurementTriple(AB_MULTIPLIER_PER_FRQ2, p0.z, v2, &saturatedZ);
 
   float3 a = select((float3)(ab0.x, ab1.x, ab2.x), (float3)(0.0f), invalid_pixel);
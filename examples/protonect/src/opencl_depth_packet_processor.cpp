@@ -25,6 +25,7 @@
  */
 
 #include <libfreenect2/depth_packet_processor.h>
+#include <libfreenect2/frame_pool.h>
 #include <libfreenect2/resource.h>
 #include <libfreenect2/protocol/response.h>
 
@@ -78,6 +79,7 @@ public:
   cl_float x_table[512 * 424];
   cl_float z_table[512 * 424];
   cl_float3 p0_table[512 * 424];
+  cl_uint decode_table[512 * 424];
   libfreenect2::DepthPacketProcessor::Config config;
   DepthPacketProcessor::Parameters params;
 
@@ -87,6 +89,7 @@ public:
   double timing_current_start;
 
   Frame *ir_frame, *depth_frame;
+  FramePool *ir_frame_pool, *depth_frame_pool;
 
   cl::Context context;
   cl::Device device;
@@ -104,12 +107,14 @@ public:
   // Read only buffers
   size_t buf_lut11to16_size;
   size_t buf_p0_table_size;
+  size_t buf_decode_table_size;
   size_t buf_x_table_size;
   size_t buf_z_table_size;
   size_t buf_packet_size;
 
   cl::Buffer buf_lut11to16;
   cl::Buffer buf_p0_table;
+  cl::Buffer buf_decode_table;
   cl::Buffer buf_x_table;
   cl::Buffer buf_z_table;
   cl::Buffer buf_packet;
@@ -147,6 +152,8 @@ public:
     , programBuilt(false)
     , programInitialized(false)
   {
+    ir_frame_pool = new FramePool(512, 424, 4);
+    depth_frame_pool = new FramePool(512, 424, 4);
     newIrFrame();
     newDepthFrame();
 
@@ -155,15 +162,25 @@ public:
     timing_current_start = 0.0;
     image_size = 512 * 424;
 
+    fill_decode_table();
+
     deviceInitialized = initDevice(deviceId);
   }
 
+  ~OpenCLDepthPacketProcessorImpl()
+  {
+    delete ir_frame;
+    delete depth_frame;
+    ir_frame_pool->release();
+    depth_frame_pool->release();
+  }
+
   void generateOptions(std::string &options) const
   {
     std::ostringstream oss;
     oss.precision(16);
     oss << std::scientific;
-    oss << " -D BFI_BITMASK=" << "0x180";
+    oss << " -D DECODE_INVALID_ADDRESS=" << "0xffffffffu";
 
     oss << " -D AB_MULTIPLIER=" << params.ab_multiplier << "f";
     oss << " -D AB_MULTIPLIER_PER_FRQ0=" << params.ab_multiplier_per_frq[0] << "f";
@@ -377,12 +394,14 @@ public:
       //Read only
       buf_lut11to16_size = 2048 * sizeof(cl_short);
       buf_p0_table_size = image_size * sizeof(cl_float3);
+      buf_decode_table_size = image_size * sizeof(cl_uint);
       buf_x_table_size = image_size * sizeof(cl_float);
       buf_z_table_size = image_size * sizeof(cl_float);
       buf_packet_size = ((image_size * 11) / 16) * 10 * sizeof(cl_ushort);
 
       buf_lut11to16 = cl::Buffer(context, CL_READ_ONLY_CACHE, buf_lut11to16_size, NULL, &err);
       buf_p0_table = cl::Buffer(context, CL_READ_ONLY_CACHE, buf_p0_table_size, NULL, &err);
+      buf_decode_table = cl::Buffer(context, CL_READ_ONLY_CACHE, buf_decode_table_size, NULL, &err);
       buf_x_table = cl::Buffer(context, CL_READ_ONLY_CACHE, buf_x_table_size, NULL, &err);
       buf_z_table = cl::Buffer(context, CL_READ_ONLY_CACHE, buf_z_table_size, NULL, &err);
       buf_packet = cl::Buffer(context, CL_READ_ONLY_CACHE, buf_packet_size, NULL, &err);
@@ -415,10 +434,11 @@ public:
       kernel_processPixelStage1.setArg(1, buf_z_table);
       kernel_processPixelStage1.setArg(2, buf_p0_table);
       kernel_processPixelStage1.setArg(3, buf_packet);
-      kernel_processPixelStage1.setArg(4, buf_a);
-      kernel_processPixelStage1.setArg(5, buf_b);
-      kernel_processPixelStage1.setArg(6, buf_n);
-      kernel_processPixelStage1.setArg(7, buf_ir);
+      kernel_processPixelStage1.setArg(4, buf_decode_table);
+      kernel_processPixelStage1.setArg(5, buf_a);
+      kernel_processPixelStage1.setArg(6, buf_b);
+      kernel_processPixelStage1.setArg(7, buf_n);
+      kernel_processPixelStage1.setArg(8, buf_ir);
 
       kernel_filterPixelStage1 = cl::Kernel(program, "filterPixelStage1", &err);
       kernel_filterPixelStage1.setArg(0, buf_a);
@@ -442,16 +462,18 @@ public:
       kernel_filterPixelStage2.setArg(2, buf_edge_test);
       kernel_filterPixelStage2.setArg(3, buf_filtered);
 
-      cl::Event event0, event1, event2, event3;
+      cl::Event event0, event1, event2, event3, event4;
       queue.enqueueWriteBuffer(buf_lut11to16, CL_FALSE, 0, buf_lut11to16_size, lut11to16, NULL, &event0);
       queue.enqueueWriteBuffer(buf_p0_table, CL_FALSE, 0, buf_p0_table_size, p0_table, NULL, &event1);
       queue.enqueueWriteBuffer(buf_x_table, CL_FALSE, 0, buf_x_table_size, x_table, NULL, &event2);
       queue.enqueueWriteBuffer(buf_z_table, CL_FALSE, 0, buf_z_table_size, z_table, NULL, &event3);
+      queue.enqueueWriteBuffer(buf_decode_table, CL_FALSE, 0, buf_decode_table_size, decode_table, NULL, &event4);
 
       event0.wait();
       event1.wait();
       event2.wait();
       event3.wait();
+      event4.wait();
     }
     catch(const cl::Error &err)
     {
@@ -462,7 +484,7 @@ public:
     return true;
   }
 
-  void run(const DepthPacket &packet)
+  void run(const DepthPacket &packet, bool want_ir, bool want_depth)
   {
     try
     {
@@ -472,7 +494,17 @@ public:
       queue.enqueueWriteBuffer(buf_packet, CL_FALSE, 0, buf_packet_size, packet.buffer, NULL, &eventWrite[0]);
 
       queue.enqueueNDRangeKernel(kernel_processPixelStage1, cl::NullRange, cl::NDRange(image_size), cl::NullRange, &eventWrite, &eventPPS1[0]);
-      queue.enqueueReadBuffer(buf_ir, CL_FALSE, 0, buf_ir_size, ir_frame->data, &eventPPS1, &event0);
+
+      if(want_ir)
+      {
+        queue.enqueueReadBuffer(buf_ir, CL_FALSE, 0, buf_ir_size, ir_frame->data, &eventPPS1, &event0);
+      }
+
+      if(!want_depth)
+      {
+        if(want_ir) event0.wait();
+        return;
+      }
 
       if(config.EnableBilateralFilter)
       {
@@ -495,7 +527,7 @@ public:
       }
 
       queue.enqueueReadBuffer(config.EnableEdgeAwareFilter ? buf_filtered : buf_depth, CL_FALSE, 0, buf_depth_size, depth_frame->data, &eventFPS2, &event1);
-      event0.wait();
+      if(want_ir) event0.wait();
       event1.wait();
     }
     catch(const cl::Error &err)
@@ -564,12 +596,42 @@ public:
 
   void newIrFrame()
   {
-    ir_frame = new Frame(512, 424, 4);
+    ir_frame = ir_frame_pool->allocate();
   }
 
   void newDepthFrame()
   {
-    depth_frame = new Frame(512, 424, 4);
+    depth_frame = depth_frame_pool->allocate();
+  }
+
+  /**
+   * Precomputes for every output pixel where its 11bit values are stored in a sub image of the raw packet,
+   * packed as word offset << 4 | bit shift. The geometry does not depend on the data, so the kernel only
+   * has to add the sub image offset.
+   */
+  void fill_decode_table()
+  {
+    for(int y = 0; y < 424; ++y)
+    {
+      // the output image is flipped vertically, raw rows are stored bottom half first
+      const int y_in = 423 - y;
+      const int row = y_in < 212 ? y_in + 212 : 423 - y_in;
+
+      for(int x = 0; x < 512; ++x)
+      {
+        const int idx = ((x >> 2) + ((x << 7) & 0x180)) * 11;
+        const int col = idx >> 4;
+
+        if(x < 1 || 510 < x || col > 352)
+        {
+          decode_table[y * 512 + x] = 0xffffffffu;
+        }
+        else
+        {
+          decode_table[y * 512 + x] = ((row * 352 + col) << 4) | (idx & 15);
+        }
+      }
+    }
   }
 
   void fill_trig_table(const libfreenect2::protocol::P0TablesResponse *p0table)
@@ -663,6 +725,10 @@ void OpenCLDepthPacketProcessor::load11To16LutFromFile(const char *filename)
 void OpenCLDepthPacketProcessor::process(const DepthPacket &packet)
 {
   bool has_listener = this->listener_ != 0;
+  unsigned int frame_types = has_listener ? this->listener_->subscribedFrameTypes() : Frame::Ir | Frame::Depth;
+  bool want_ir = (frame_types & Frame::Ir) != 0, want_depth = (frame_types & Frame::Depth) != 0;
+
+  if(!want_ir && !want_depth) return;
 
   if(!impl_->programInitialized && !impl_->initProgram())
   {
@@ -676,19 +742,30 @@ void OpenCLDepthPacketProcessor::process(const DepthPacket &packet)
   impl_->depth_frame->timestamp = packet.timestamp;
   impl_->ir_frame->sequence = packet.sequence;
   impl_->depth_frame->sequence = packet.sequence;
+  impl_->ir_frame->trace = packet.trace;
+  impl_->ir_frame->trace.mark(FrameTrace::ProcessingStart);
 
-  impl_->run(packet);
+  impl_->run(packet, want_ir, want_depth);
 
   impl_->stopTiming();
 
+  impl_->ir_frame->trace.mark(FrameTrace::ProcessingEnd);
+  impl_->depth_frame->trace = impl_->ir_frame->trace;
+
   if(has_listener)
   {
-    if(this->listener_->onNewFrame(Frame::Ir, impl_->ir_frame))
+    if(want_ir)
+      impl_->ir_frame->trace.mark(FrameTrace::ListenerDelivery);
+
+    if(want_ir && this->listener_->onNewFrame(Frame::Ir, impl_->ir_frame))
     {
       impl_->newIrFrame();
     }
 
-    if(this->listener_->onNewFrame(Frame::Depth, impl_->depth_frame))
+    if(want_depth)
+      impl_->depth_frame->trace.mark(FrameTrace::ListenerDelivery);
+
+    if(want_depth && this->listener_->onNewFrame(Frame::Depth, impl_->depth_frame))
     {
       impl_->newDepthFrame();
     }
@@ -25,6 +25,7 @@
  */
 
 #include <libfreenect2/depth_packet_processor.h>
+#include <libfreenect2/frame_pool.h>
 #include <libfreenect2/resource.h>
 #include <libfreenect2/protocol/response.h>
 #include "flextGL.h"
@@ -256,11 +257,19 @@ public:
   GLuint texture;
   unsigned char *data;
   size_t size;
+  // recycles the frames of downloadToNewFrame()
+  FramePool *frame_pool;
 
-  Texture() : texture(0), data(0), size(0), bytes_per_pixel(FormatT::BytesPerPixel), height(0), width(0)
+  Texture() : texture(0), data(0), size(0), bytes_per_pixel(FormatT::BytesPerPixel), height(0), width(0), frame_pool(0)
   {
   }
 
+  ~Texture()
+  {
+    if(frame_pool != 0)
+      frame_pool->release();
+  }
+
   void bindToUnit(GLenum unit)
   {
     gl()->glActiveTexture(unit);
@@ -325,7 +334,10 @@ public:
 
   Frame *downloadToNewFrame()
   {
-    Frame *f = new Frame(width, height, bytes_per_pixel);
+    if(frame_pool == 0)
+      frame_pool = new FramePool(width, height, bytes_per_pixel);
+
+    Frame *f = frame_pool->allocate();
     downloadToBuffer(f->data);
     flipYBuffer(f->data);
 
@@ -653,6 +665,9 @@ struct OpenGLDepthPacketProcessorImpl : public WithOpenGLBindings
       *ir = stage1_infrared.downloadToNewFrame();
     }
 
+    // the remaining passes only produce depth
+    if(depth == 0 && !do_debug) return;
+
     if(config.EnableBilateralFilter)
     {
       // bilateral filter
@@ -924,7 +939,11 @@ void OpenGLDepthPacketProcessor::load11To16LutFromFile(const char* filename)
 void OpenGLDepthPacketProcessor::process(const DepthPacket &packet)
 {
   bool has_listener = this->listener_ != 0;
+  unsigned int frame_types = has_listener ? this->listener_->subscribedFrameTypes() : 0;
+  bool want_ir = (frame_types & Frame::Ir) != 0, want_depth = (frame_types & Frame::Depth) != 0;
   Frame *ir = 0, *depth = 0;
+  FrameTrace trace = packet.trace;
+  trace.mark(FrameTrace::ProcessingStart);
 
   impl_->startTiming();
 
@@ -932,23 +951,33 @@ void OpenGLDepthPacketProcessor::process(const DepthPacket &packet)
 
   std::copy(packet.buffer, packet.buffer + packet.buffer_length, impl_->input_data.data);
   impl_->input_data.upload();
-  impl_->run(has_listener ? &ir : 0, has_listener ? &depth : 0);
+  impl_->run(want_ir ? &ir : 0, want_depth ? &depth : 0);
 
   if(impl_->do_debug) glfwSwapBuffers(impl_->opengl_context_ptr);
 
   impl_->stopTiming();
 
-  if(has_listener)
+  trace.mark(FrameTrace::ProcessingEnd);
+
+  if(want_ir)
   {
     ir->timestamp = packet.timestamp;
-    depth->timestamp = packet.timestamp;
     ir->sequence = packet.sequence;
-    depth->sequence = packet.sequence;
+    ir->trace = trace;
+    ir->trace.mark(FrameTrace::ListenerDelivery);
 
     if(!this->listener_->onNewFrame(Frame::Ir, ir))
     {
       delete ir;
     }
+  }
+
+  if(want_depth)
+  {
+    depth->timestamp = packet.timestamp;
+    depth->sequence = packet.sequence;
+    depth->trace = trace;
+    depth->trace.mark(FrameTrace::ListenerDelivery);
 
     if(!this->listener_->onNewFrame(Frame::Depth, depth))
     {
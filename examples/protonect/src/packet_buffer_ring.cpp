@@ -0,0 +1,232 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+
+#include <libfreenect2/packet_buffer_ring.h>
+#include <iostream>
+#include <memory.h>
+
+namespace libfreenect2
+{
+
+void PacketBuffer::retain()
+{
+  ring->retain(this);
+}
+
+void PacketBuffer::release()
+{
+  ring->release(this);
+}
+
+void PacketBuffer::append(unsigned char *src, size_t n, DataReference *reference)
+{
+  if(reference != 0 && num_lent == MaxLent)
+  {
+    // no room to keep another reference, give the memory back right away
+    memcpy(data + length, src, n);
+    reference->release();
+  }
+  else if(reference == 0)
+  {
+    memcpy(data + length, src, n);
+  }
+  else
+  {
+    lent[num_lent++] = reference;
+
+    // consecutive source buffers often are adjacent in memory
+    Segment *last = num_segments > 0 ? &segments[num_segments - 1] : 0;
+
+    if(last != 0 && last->offset + last->length == length && last->data + last->length == src)
+    {
+      last->length += n;
+    }
+    else
+    {
+      Segment segment = { length, src, n };
+      segments[num_segments++] = segment;
+    }
+  }
+
+  length += n;
+}
+
+void PacketBuffer::read(size_t offset, unsigned char *dst, size_t n) const
+{
+  memcpy(dst, data + offset, n);
+
+  // overwrite the parts which are not in data
+  for(size_t i = 0; i < num_segments; ++i)
+  {
+    const Segment &s = segments[i];
+    size_t begin = s.offset > offset ? s.offset : offset;
+    size_t end = s.offset + s.length < offset + n ? s.offset + s.length : offset + n;
+
+    if(begin < end)
+    {
+      memcpy(dst + (begin - offset), s.data + (begin - s.offset), end - begin);
+    }
+  }
+}
+
+void PacketBuffer::gather()
+{
+  if(num_segments == 0) return;
+
+  for(size_t i = 0; i < num_segments; ++i)
+  {
+    memcpy(data + segments[i].offset, segments[i].data, segments[i].length);
+  }
+  num_segments = 0;
+
+  for(size_t i = 0; i < num_lent; ++i)
+  {
+    lent[i]->release();
+  }
+  num_lent = 0;
+}
+
+void PacketBuffer::clear()
+{
+  for(size_t i = 0; i < num_lent; ++i)
+  {
+    lent[i]->release();
+  }
+  num_lent = 0;
+  num_segments = 0;
+  length = 0;
+}
+
+PacketBufferRing::PacketBufferRing() :
+    next_(0),
+    buffer_data_(0)
+{
+}
+
+PacketBufferRing::~PacketBufferRing()
+{
+  // give back the lent memory, while its source still exists
+  for(size_t i = 0; i < buffer_.size(); ++i)
+  {
+    buffer_[i].clear();
+  }
+
+  if(buffer_data_ != 0)
+  {
+    buffer_.clear();
+    delete[] buffer_data_;
+  }
+}
+
+void PacketBufferRing::allocate(size_t num_buffers, size_t buffer_size)
+{
+  size_t total_buffer_size = num_buffers * buffer_size;
+  buffer_data_ = new unsigned char[total_buffer_size];
+
+  buffer_.resize(num_buffers);
+
+  for(size_t i = 0; i < num_buffers; ++i)
+  {
+    buffer_[i].capacity = buffer_size;
+    buffer_[i].length = 0;
+    buffer_[i].data = buffer_data_ + i * buffer_size;
+    buffer_[i].ring = this;
+    buffer_[i].references = 0;
+    buffer_[i].num_segments = 0;
+    buffer_[i].num_lent = 0;
+  }
+}
+
+PacketBuffer *PacketBufferRing::acquire()
+{
+  libfreenect2::lock_guard l(mutex_);
+
+  // hand out the buffers in order, so the one released longest ago is reused first
+  for(size_t i = 0; i < buffer_.size(); ++i)
+  {
+    PacketBuffer &b = buffer_[(next_ + i) % buffer_.size()];
+
+    if(b.references == 0)
+    {
+      next_ = (next_ + i + 1) % buffer_.size();
+      b.references = 1;
+      b.length = 0;
+      return &b;
+    }
+  }
+
+  return 0;
+}
+
+void PacketBufferRing::retain(PacketBuffer *buffer)
+{
+  libfreenect2::lock_guard l(mutex_);
+  buffer->references += 1;
+}
+
+void PacketBufferRing::release(PacketBuffer *buffer)
+{
+  DataReference *lent[PacketBuffer::MaxLent];
+  size_t num_lent = 0;
+
+  {
+    libfreenect2::lock_guard l(mutex_);
+
+    if(buffer->references == 0)
+    {
+      std::cerr << "[PacketBufferRing::release] buffer released too often!" << std::endl;
+      return;
+    }
+
+    buffer->references -= 1;
+
+    if(buffer->references == 0)
+    {
+      // the processor did not need the lent memory anymore
+      for(; num_lent < buffer->num_lent; ++num_lent)
+      {
+        lent[num_lent] = buffer->lent[num_lent];
+      }
+      buffer->num_lent = 0;
+      buffer->num_segments = 0;
+      buffer->length = 0;
+    }
+  }
+
+  // giving the memory back can resubmit a transfer, so it is done without holding the lock
+  for(size_t i = 0; i < num_lent; ++i)
+  {
+    lent[i]->release();
+  }
+}
+
+size_t PacketBufferRing::size() const
+{
+  return buffer_.size();
+}
+
+} /* namespace libfreenect2 */
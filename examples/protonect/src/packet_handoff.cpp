@@ -0,0 +1,249 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+
+#include <libfreenect2/packet_handoff.h>
+#include <libfreenect2/threading.h>
+#include <libfreenect2/frame_trace.h>
+#include <iostream>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#endif
+
+namespace libfreenect2
+{
+
+class WakeupEventImpl
+{
+public:
+  // eventfd, -1 if the platform has none or it could not be created, the condition variable is used then
+  int fd;
+
+  libfreenect2::mutex mutex;
+  libfreenect2::condition_variable condition;
+  bool signaled;
+
+  WakeupEventImpl() : fd(-1), signaled(false)
+  {
+#ifdef __linux__
+    fd = eventfd(0, 0);
+
+    if(fd < 0)
+    {
+      std::cerr << "[WakeupEvent] failed to create eventfd, using a condition variable instead!" << std::endl;
+    }
+#endif
+  }
+
+  ~WakeupEventImpl()
+  {
+#ifdef __linux__
+    if(fd >= 0)
+      close(fd);
+#endif
+  }
+
+  void notify()
+  {
+#ifdef __linux__
+    if(fd >= 0)
+    {
+      uint64_t value = 1;
+
+      // the counter can not overflow, so the write never blocks
+      while(write(fd, &value, sizeof(value)) < 0 && errno == EINTR);
+      return;
+    }
+#endif
+
+    {
+      libfreenect2::lock_guard l(mutex);
+      signaled = true;
+    }
+    condition.notify_one();
+  }
+
+  void wait()
+  {
+#ifdef __linux__
+    if(fd >= 0)
+    {
+      uint64_t value;
+
+      while(read(fd, &value, sizeof(value)) < 0 && errno == EINTR);
+      return;
+    }
+#endif
+
+    libfreenect2::unique_lock l(mutex);
+
+    while(!signaled)
+    {
+      WAIT_CONDITION(condition, mutex, l);
+    }
+
+    signaled = false;
+  }
+
+  bool waitFor(double timeout)
+  {
+#ifdef __linux__
+    if(fd >= 0)
+    {
+      pollfd p = { fd, POLLIN, 0 };
+      double deadline = FrameTrace::now() + timeout;
+      int r;
+
+      do
+      {
+        // round up, so it does not wake up just before the deadline, and stay in the range of int
+        double remaining = deadline - FrameTrace::now();
+        int milliseconds = remaining <= 0.0 ? 0 : remaining < 1e6 ? static_cast<int>(remaining * 1000.0) + 1 : 1000000000;
+        r = poll(&p, 1, milliseconds);
+      }
+      while(r < 0 && errno == EINTR);
+
+      if(r <= 0)
+        return false;
+
+      // readable, so this does not block
+      wait();
+      return true;
+    }
+#endif
+
+    libfreenect2::unique_lock l(mutex);
+
+#ifdef LIBFREENECT2_THREADING_STDLIB
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() +
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(timeout));
+
+    while(!signaled)
+    {
+      if(condition.wait_until(l, deadline) == std::cv_status::timeout && !signaled)
+        return false;
+    }
+#else
+    // tinythread has no timed wait
+    for(double start = FrameTrace::now(); !signaled;)
+    {
+      if(FrameTrace::now() - start >= timeout)
+        return false;
+
+      mutex.unlock();
+      libfreenect2::this_thread::sleep_for(libfreenect2::chrono::milliseconds(1));
+      mutex.lock();
+    }
+#endif
+
+    signaled = false;
+    return true;
+  }
+
+  void reset()
+  {
+#ifdef __linux__
+    if(fd >= 0)
+    {
+      pollfd p = { fd, POLLIN, 0 };
+
+      // only read if it does not block, reading resets the counter to 0
+      if(poll(&p, 1, 0) > 0)
+        wait();
+      return;
+    }
+#endif
+
+    libfreenect2::lock_guard l(mutex);
+    signaled = false;
+  }
+
+  int fileDescriptor() const
+  {
+    return fd;
+  }
+};
+
+WakeupEvent::WakeupEvent() :
+    impl_(new WakeupEventImpl())
+{
+}
+
+WakeupEvent::~WakeupEvent()
+{
+  delete impl_;
+}
+
+void WakeupEvent::notify()
+{
+  impl_->notify();
+}
+
+void WakeupEvent::reset()
+{
+  impl_->reset();
+}
+
+int WakeupEvent::fileDescriptor() const
+{
+  return impl_->fileDescriptor();
+}
+
+void WakeupEvent::wait()
+{
+  impl_->wait();
+}
+
+bool WakeupEvent::waitFor(double timeout)
+{
+  return impl_->waitFor(timeout);
+}
+
+HandoffStatistics::HandoffStatistics() :
+    packets(0),
+    latency_sum(0.0),
+    latency_max(0.0)
+{
+}
+
+double HandoffStatistics::averageLatency() const
+{
+  return packets > 0 ? latency_sum / packets : 0.0;
+}
+
+void HandoffStatistics::add(double latency)
+{
+  packets += 1;
+  latency_sum += latency;
+  latency_max = latency > latency_max ? latency : latency_max;
+}
+
+} /* namespace libfreenect2 */
@@ -26,24 +26,101 @@
 
 #include <libfreenect2/packet_pipeline.h>
 #include <libfreenect2/async_packet_processor.h>
+#include <libfreenect2/parallel_packet_processor.h>
 
 namespace libfreenect2
 {
 
+// number of packets buffered while a processor is busy, the parsers need three more buffers than that
+static const size_t packet_queue_size = 2;
+
 PacketPipeline::~PacketPipeline()
 {
 }
 
-void BasePacketPipeline::initialize()
+BackpressureControl *PacketPipeline::getRgbPacketQueue() const
+{
+  return 0;
+}
+
+BackpressureControl *PacketPipeline::getDepthPacketQueue() const
+{
+  return 0;
+}
+
+ParserStatistics PacketPipeline::getRgbParserStatistics() const
 {
-  rgb_parser_ = new RgbPacketStreamParser();
-  depth_parser_ = new DepthPacketStreamParser();
+  return ParserStatistics();
+}
 
-  rgb_processor_ = new TurboJpegRgbPacketProcessor();
-  depth_processor_ = createDepthPacketProcessor();
+ParserStatistics PacketPipeline::getIrParserStatistics() const
+{
+  return ParserStatistics();
+}
+
+BasePacketPipeline::BasePacketPipeline() :
+    rgb_packet_queue_(0),
+    depth_packet_queue_(0),
+    num_depth_workers_(1),
+    num_rgb_workers_(1)
+{
+}
 
-  async_rgb_processor_ = new AsyncPacketProcessor<RgbPacket>(rgb_processor_);
-  async_depth_processor_ = new AsyncPacketProcessor<DepthPacket>(depth_processor_);
+void BasePacketPipeline::initialize()
+{
+  size_t num_rgb_buffers = packet_queue_size + 3;
+  size_t num_depth_buffers = packet_queue_size + 3;
+
+  if(num_rgb_workers_ > 1)
+  {
+    std::vector<RgbPacketProcessor *> rgb_processors;
+
+    for(size_t i = 0; i < num_rgb_workers_; ++i)
+    {
+      rgb_processors.push_back(new TurboJpegRgbPacketProcessor());
+    }
+
+    // runs its own worker threads, every worker holds up to queue size + 1 buffers
+    ParallelRgbPacketProcessor *parallel_rgb_processor = new ParallelRgbPacketProcessor(rgb_processors, packet_queue_size);
+    rgb_processor_ = parallel_rgb_processor;
+    async_rgb_processor_ = parallel_rgb_processor;
+    rgb_packet_queue_ = parallel_rgb_processor;
+    num_rgb_buffers = num_rgb_workers_ * (packet_queue_size + 1) + 1;
+  }
+  else
+  {
+    rgb_processor_ = new TurboJpegRgbPacketProcessor();
+    AsyncPacketProcessor<RgbPacket> *async_rgb_processor = new AsyncPacketProcessor<RgbPacket>(rgb_processor_, packet_queue_size);
+    async_rgb_processor_ = async_rgb_processor;
+    rgb_packet_queue_ = async_rgb_processor;
+  }
+
+  if(num_depth_workers_ > 1)
+  {
+    std::vector<DepthPacketProcessor *> depth_processors;
+
+    for(size_t i = 0; i < num_depth_workers_; ++i)
+    {
+      depth_processors.push_back(createDepthPacketProcessor());
+    }
+
+    // runs its own worker threads, every worker holds up to queue size + 1 buffers
+    ParallelDepthPacketProcessor *parallel_depth_processor = new ParallelDepthPacketProcessor(depth_processors, packet_queue_size);
+    depth_processor_ = parallel_depth_processor;
+    async_depth_processor_ = parallel_depth_processor;
+    depth_packet_queue_ = parallel_depth_processor;
+    num_depth_buffers = num_depth_workers_ * (packet_queue_size + 1) + 1;
+  }
+  else
+  {
+    depth_processor_ = createDepthPacketProcessor();
+    AsyncPacketProcessor<DepthPacket> *async_depth_processor = new AsyncPacketProcessor<DepthPacket>(depth_processor_, packet_queue_size);
+    async_depth_processor_ = async_depth_processor;
+    depth_packet_queue_ = async_depth_processor;
+  }
+
+  rgb_parser_ = new RgbPacketStreamParser(num_rgb_buffers);
+  depth_parser_ = new DepthPacketStreamParser(num_depth_buffers);
 
   rgb_parser_->setPacketProcessor(async_rgb_processor_);
   depth_parser_->setPacketProcessor(async_depth_processor_);
@@ -51,8 +128,10 @@ void BasePacketPipeline::initialize()
 
 BasePacketPipeline::~BasePacketPipeline()
 {
-  delete async_rgb_processor_;
-  delete async_depth_processor_;
+  if(async_rgb_processor_ != rgb_processor_)
+    delete async_rgb_processor_;
+  if(async_depth_processor_ != depth_processor_)
+    delete async_depth_processor_;
   delete rgb_processor_;
   delete depth_processor_;
   delete rgb_parser_;
@@ -79,8 +158,30 @@ DepthPacketProcessor *BasePacketPipeline::getDepthPacketProcessor() const
   return depth_processor_;
 }
 
-CpuPacketPipeline::CpuPacketPipeline()
+BackpressureControl *BasePacketPipeline::getRgbPacketQueue() const
+{
+  return rgb_packet_queue_;
+}
+
+BackpressureControl *BasePacketPipeline::getDepthPacketQueue() const
+{
+  return depth_packet_queue_;
+}
+
+ParserStatistics BasePacketPipeline::getRgbParserStatistics() const
+{
+  return rgb_parser_->statistics();
+}
+
+ParserStatistics BasePacketPipeline::getIrParserStatistics() const
+{
+  return depth_parser_->statistics();
+}
+
+CpuPacketPipeline::CpuPacketPipeline(size_t num_depth_workers, size_t num_rgb_workers)
 { 
+  num_depth_workers_ = num_depth_workers;
+  num_rgb_workers_ = num_rgb_workers;
   initialize();
 }
 
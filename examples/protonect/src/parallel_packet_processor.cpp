@@ -0,0 +1,319 @@
+/*
+ * This file is part of the OpenKinect Project. http://www.openkinect.org
+ *
+ * Copyright (c) 2014 individual OpenKinect contributors. See the CONTRIB file
+ * for details.
+ *
+ * This code is licensed to you under the terms of the Apache License, version
+ * 2.0, or, at your option, the terms of the GNU General Public License,
+ * version 2.0. See the APACHE20 and GPL2 files for the text of the licenses,
+ * or the following URLs:
+ * http://www.apache.org/licenses/LICENSE-2.0
+ * http://www.gnu.org/licenses/gpl-2.0.txt
+ *
+ * If you redistribute this file in source form, modified or unmodified, you
+ * may:
+ *   1) Leave this header intact and distribute it under the same terms,
+ *      accompanying it with the APACHE20 and GPL20 files, or
+ *   2) Delete the Apache 2.0 clause and accompany it with the GPL2 file, or
+ *   3) Delete the GPL v2 clause and accompany it with the APACHE20 file
+ * In all cases you must keep the copyright notice intact and include a copy
+ * of the CONTRIB file.
+ *
+ * Binary distributions must follow the binary distribution requirements of
+ * either License.
+ */
+
+
+#include <libfreenect2/parallel_packet_processor.h>
+#include <iostream>
+
+namespace libfreenect2
+{
+
+class FrameSequencer::Port : public FrameListener
+{
+public:
+  FrameSequencer *sequencer;
+  FrameList frames;
+
+  Port(FrameSequencer *sequencer) : sequencer(sequencer)
+  {
+  }
+
+  virtual ~Port()
+  {
+  }
+
+  virtual bool onNewFrame(Frame::Type type, Frame *frame)
+  {
+    frames.push_back(std::make_pair(type, frame));
+    return true;
+  }
+
+  virtual unsigned int subscribedFrameTypes() const
+  {
+    return sequencer->subscribedFrameTypes();
+  }
+};
+
+FrameSequencer::FrameSequencer(size_t num_workers) :
+    listener_(0),
+    completed_(num_workers),
+    next_worker_(0),
+    delivering_(false),
+    subscribed_frame_types_(0)
+{
+  for(size_t i = 0; i < num_workers; ++i)
+  {
+    ports_.push_back(new Port(this));
+  }
+}
+
+FrameSequencer::~FrameSequencer()
+{
+  for(size_t i = 0; i < ports_.size(); ++i)
+  {
+    for(size_t j = 0; j < completed_[i].size(); ++j)
+    {
+      for(size_t k = 0; k < completed_[i][j].size(); ++k)
+        delete completed_[i][j][k].second;
+    }
+
+    for(size_t k = 0; k < ports_[i]->frames.size(); ++k)
+      delete ports_[i]->frames[k].second;
+
+    delete ports_[i];
+  }
+}
+
+void FrameSequencer::setFrameListener(libfreenect2::FrameListener *listener)
+{
+  libfreenect2::unique_lock l(mutex_);
+
+  while(delivering_)
+  {
+    WAIT_CONDITION(delivered_, mutex_, l)
+  }
+
+  listener_ = listener;
+  subscribed_frame_types_.store(listener != 0 ? listener->subscribedFrameTypes() : 0);
+}
+
+libfreenect2::FrameListener *FrameSequencer::port(size_t worker)
+{
+  return ports_[worker];
+}
+
+void FrameSequencer::complete(size_t worker)
+{
+  {
+    libfreenect2::lock_guard l(mutex_);
+
+    completed_[worker].push_back(FrameList());
+    completed_[worker].back().swap(ports_[worker]->frames);
+
+    // the worker delivering already passes these frames on in order
+    if(delivering_)
+      return;
+
+    delivering_ = true;
+  }
+
+  while(true)
+  {
+    FrameList frames;
+    libfreenect2::FrameListener *listener;
+
+    {
+      libfreenect2::lock_guard l(mutex_);
+
+      // take everything which is complete up to the first packet still being processed
+      while(!completed_[next_worker_].empty())
+      {
+        FrameList &next = completed_[next_worker_].front();
+        frames.insert(frames.end(), next.begin(), next.end());
+        completed_[next_worker_].pop_front();
+
+        next_worker_ = (next_worker_ + 1) % completed_.size();
+      }
+
+      if(frames.empty())
+      {
+        delivering_ = false;
+        delivered_.notify_all();
+        return;
+      }
+
+      listener = listener_;
+    }
+
+    deliver(frames, listener);
+  }
+}
+
+BackpressurePolicy FrameSequencer::workerPolicy(const BackpressurePolicy &policy)
+{
+  BackpressurePolicy worker_policy = policy;
+
+  if(policy.type == BackpressurePolicy::DropOldest || policy.type == BackpressurePolicy::Coalesce)
+  {
+    std::cerr << "[FrameSequencer::workerPolicy] queued packets can not be dropped, using DropNewest" << std::endl;
+    worker_policy.type = BackpressurePolicy::DropNewest;
+  }
+
+  return worker_policy;
+}
+
+unsigned int FrameSequencer::subscribedFrameTypes() const
+{
+  return static_cast<unsigned int>(subscribed_frame_types_.load());
+}
+
+void FrameSequencer::deliver(FrameList &frames, libfreenect2::FrameListener *listener)
+{
+  for(size_t i = 0; i < frames.size(); ++i)
+  {
+    // the frame may have waited for the ones of earlier packets
+    frames[i].second->trace.mark(FrameTrace::ListenerDelivery);
+
+    if(listener == 0 || !listener->onNewFrame(frames[i].first, frames[i].second))
+    {
+      delete frames[i].second;
+    }
+  }
+}
+
+ParallelDepthPacketProcessor::ParallelDepthPacketProcessor(const std::vector<DepthPacketProcessor *> &processors, size_t queue_size) :
+    processors_(processors),
+    sequencer_(processors.size())
+{
+  std::vector<BaseDepthPacketProcessor *> workers;
+
+  for(size_t i = 0; i < processors_.size(); ++i)
+  {
+    processors_[i]->setFrameListener(sequencer_.port(i));
+    workers.push_back(processors_[i]);
+  }
+
+  parallel_ = new ParallelPacketProcessor<DepthPacket>(workers, &sequencer_, queue_size);
+}
+
+ParallelDepthPacketProcessor::~ParallelDepthPacketProcessor()
+{
+  // stop the workers before the processors go away
+  delete parallel_;
+
+  for(size_t i = 0; i < processors_.size(); ++i)
+  {
+    delete processors_[i];
+  }
+}
+
+void ParallelDepthPacketProcessor::setFrameListener(libfreenect2::FrameListener *listener)
+{
+  DepthPacketProcessor::setFrameListener(listener);
+  sequencer_.setFrameListener(listener);
+}
+
+void ParallelDepthPacketProcessor::setConfiguration(const libfreenect2::DepthPacketProcessor::Config &config)
+{
+  DepthPacketProcessor::setConfiguration(config);
+
+  for(size_t i = 0; i < processors_.size(); ++i)
+  {
+    processors_[i]->setConfiguration(config);
+  }
+}
+
+void ParallelDepthPacketProcessor::loadP0TablesFromCommandResponse(unsigned char* buffer, size_t buffer_length)
+{
+  for(size_t i = 0; i < processors_.size(); ++i)
+  {
+    processors_[i]->loadP0TablesFromCommandResponse(buffer, buffer_length);
+  }
+}
+
+bool ParallelDepthPacketProcessor::ready()
+{
+  return parallel_->ready();
+}
+
+void ParallelDepthPacketProcessor::process(const DepthPacket &packet)
+{
+  parallel_->process(packet);
+}
+
+bool ParallelDepthPacketProcessor::gathersLentMemory() const
+{
+  return parallel_->gathersLentMemory();
+}
+
+void ParallelDepthPacketProcessor::setBackpressurePolicy(const BackpressurePolicy &policy)
+{
+  parallel_->setBackpressurePolicy(policy);
+}
+
+BackpressureCounters ParallelDepthPacketProcessor::backpressureCounters() const
+{
+  return parallel_->backpressureCounters();
+}
+
+ParallelRgbPacketProcessor::ParallelRgbPacketProcessor(const std::vector<RgbPacketProcessor *> &processors, size_t queue_size) :
+    processors_(processors),
+    sequencer_(processors.size())
+{
+  std::vector<BaseRgbPacketProcessor *> workers;
+
+  for(size_t i = 0; i < processors_.size(); ++i)
+  {
+    processors_[i]->setFrameListener(sequencer_.port(i));
+    workers.push_back(processors_[i]);
+  }
+
+  parallel_ = new ParallelPacketProcessor<RgbPacket>(workers, &sequencer_, queue_size);
+}
+
+ParallelRgbPacketProcessor::~ParallelRgbPacketProcessor()
+{
+  // stop the workers before the processors go away
+  delete parallel_;
+
+  for(size_t i = 0; i < processors_.size(); ++i)
+  {
+    delete processors_[i];
+  }
+}
+
+void ParallelRgbPacketProcessor::setFrameListener(libfreenect2::FrameListener *listener)
+{
+  RgbPacketProcessor::setFrameListener(listener);
+  sequencer_.setFrameListener(listener);
+}
+
+bool ParallelRgbPacketProcessor::ready()
+{
+  return parallel_->ready();
+}
+
+void ParallelRgbPacketProcessor::process(const RgbPacket &packet)
+{
+  parallel_->process(packet);
+}
+
+bool ParallelRgbPacketProcessor::gathersLentMemory() const
+{
+  return parallel_->gathersLentMemory();
+}
+
+void ParallelRgbPacketProcessor::setBackpressurePolicy(const BackpressurePolicy &policy)
+{
+  parallel_->setBackpressurePolicy(policy);
+}
+
+BackpressureCounters ParallelRgbPacketProcessor::backpressureCounters() const
+{
+  return parallel_->backpressureCounters();
+}
+
+} /* namespace libfreenect2 */
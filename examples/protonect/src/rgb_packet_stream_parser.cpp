@@ -59,14 +59,21 @@ LIBFREENECT2_PACK(struct RgbPacketFooter {
   uint32_t unknown4[3]; // seems to be 0 all the time.
 });
 
-RgbPacketStreamParser::RgbPacketStreamParser() :
-    processor_(noopProcessor<RgbPacket>())
+RgbPacketStreamParser::RgbPacketStreamParser(size_t num_buffers) :
+    processor_(noopProcessor<RgbPacket>()),
+    received_bytes_(0),
+    completed_frames_(0),
+    dropped_busy_(0),
+    dropped_incomplete_(0),
+    dropped_invalid_(0)
 {
-  buffer_.allocate(1920*1080*3+sizeof(RgbPacket));
+  buffer_.allocate(num_buffers < 2 ? 2 : num_buffers, 1920*1080*3+sizeof(RgbPacket));
+  current_ = buffer_.acquire();
 }
 
 RgbPacketStreamParser::~RgbPacketStreamParser()
 {
+  current_->release();
 }
 
 void RgbPacketStreamParser::setPacketProcessor(BaseRgbPacketProcessor *processor)
@@ -74,22 +81,56 @@ void RgbPacketStreamParser::setPacketProcessor(BaseRgbPacketProcessor *processor
   processor_ = (processor != 0) ? processor : noopProcessor<RgbPacket>();
 }
 
+ParserStatistics RgbPacketStreamParser::statistics() const
+{
+  ParserStatistics s;
+  s.bytes = received_bytes_.load();
+  s.frames = completed_frames_.load();
+  s.dropped_busy = dropped_busy_.load();
+  s.dropped_incomplete = dropped_incomplete_.load();
+  s.dropped_invalid = dropped_invalid_.load();
+  return s;
+}
+
 void RgbPacketStreamParser::onDataReceived(unsigned char* buffer, size_t length)
 {
-  Buffer &fb = buffer_.front();
+  onData(buffer, length, 0);
+}
+
+bool RgbPacketStreamParser::onDataLent(unsigned char* buffer, size_t length, DataReference *reference)
+{
+  // keep the transfer buffer in the packet instead of copying it, if the processor gathers it
+  if(!processor_->gathersLentMemory())
+    return DataCallback::onDataLent(buffer, length, reference);
+
+  onData(buffer, length, reference);
+  return true;
+}
+
+void RgbPacketStreamParser::onData(unsigned char* buffer, size_t length, DataReference *reference)
+{
+  PacketBuffer &fb = *current_;
+  received_bytes_.fetch_add(length);
 
   // package containing data
   if(length > 0)
   {
+    if(fb.length == 0)
+    {
+      trace_ = FrameTrace();
+      trace_.mark(FrameTrace::FirstTransfer);
+    }
+
     if(fb.length + length <= fb.capacity)
     {
-      memcpy(fb.data + fb.length, buffer, length);
-      fb.length += length;
+      fb.append(buffer, length, reference);
     }
     else
     {
       std::cerr << "[RgbPacketStreamParser::onDataReceived] buffer overflow!" << std::endl;
-      fb.length = 0;
+      fb.clear();
+      dropped_invalid_.fetch_add(1);
+      if(reference != 0) reference->release();
       return;
     }
 
@@ -97,71 +138,105 @@ void RgbPacketStreamParser::onDataReceived(unsigned char* buffer, size_t length)
     if (fb.length <= sizeof(RawRgbPacket) + sizeof(RgbPacketFooter))
       return;
 
-    RgbPacketFooter* footer = reinterpret_cast<RgbPacketFooter *>(&fb.data[fb.length - sizeof(RgbPacketFooter)]);
+    RgbPacketFooter footer;
+    fb.read(fb.length - sizeof(RgbPacketFooter), reinterpret_cast<unsigned char *>(&footer), sizeof(RgbPacketFooter));
 
-    if (footer->magic_header == 0x39393939 && footer->magic_footer == 0x42424242)
+    if (footer.magic_header == 0x39393939 && footer.magic_footer == 0x42424242)
     {
-      RawRgbPacket *raw_packet = reinterpret_cast<RawRgbPacket *>(fb.data);
+      trace_.mark(FrameTrace::LastTransfer);
 
-      if (fb.length != footer->packet_size || raw_packet->sequence != footer->sequence)
+      RawRgbPacket raw_packet;
+      fb.read(0, reinterpret_cast<unsigned char *>(&raw_packet), sizeof(RawRgbPacket));
+
+      if (fb.length != footer.packet_size || raw_packet.sequence != footer.sequence)
       {
         std::cerr << "[RgbPacketStreamParser::onDataReceived] packetsize or sequence doesn't match!" << std::endl;
-        fb.length = 0;
+        fb.clear();
+        dropped_invalid_.fetch_add(1);
         return;
       }
 
-      if (fb.length - sizeof(RawRgbPacket) - sizeof(RgbPacketFooter) < footer->filler_length)
+      if (fb.length - sizeof(RawRgbPacket) - sizeof(RgbPacketFooter) < footer.filler_length)
       {
         std::cerr << "[RgbPacketStreamParser::onDataReceived] not enough space for packet filler!" << std::endl;
-        fb.length = 0;
+        fb.clear();
+        dropped_invalid_.fetch_add(1);
         return;
       }
 
       size_t jpeg_length = 0;
       //check for JPEG EOI 0xff 0xd9 within 0 to 3 alignment bytes
-      size_t length_no_filler = fb.length - sizeof(RawRgbPacket) - sizeof(RgbPacketFooter) - footer->filler_length;
+      size_t length_no_filler = fb.length - sizeof(RawRgbPacket) - sizeof(RgbPacketFooter) - footer.filler_length;
+      unsigned char tail[5];
+      size_t tail_length = length_no_filler < sizeof(tail) ? length_no_filler : sizeof(tail);
+      fb.read(sizeof(RawRgbPacket) + length_no_filler - tail_length, tail, tail_length);
+
       for (size_t i = 0; i < 4; i++)
       {
         if (length_no_filler < i + 2)
           break;
-        size_t eoi = length_no_filler - i;
+        size_t eoi = tail_length - i;
 
-        if (raw_packet->jpeg_buffer[eoi - 2] == 0xff && raw_packet->jpeg_buffer[eoi - 1] == 0xd9)
-          jpeg_length = eoi;
+        if (tail[eoi - 2] == 0xff && tail[eoi - 1] == 0xd9)
+          jpeg_length = length_no_filler - i;
       }
 
       if (jpeg_length == 0)
       {
         std::cerr << "[RgbPacketStreamParser::onDataReceived] no JPEG detected!" << std::endl;
-        fb.length = 0;
+        fb.clear();
+        dropped_invalid_.fetch_add(1);
         return;
       }
 
-      // can the processor handle the next image?
-      if(processor_->ready())
-      {
-        buffer_.swap();
-        Buffer &bb = buffer_.back();
+      // can the processor handle the next image? it may keep the buffer, so the next image has to go to a free one
+      // a refusal of ready() is counted by the processor queue
+      bool accepted = processor_->ready();
+      PacketBuffer *next = accepted ? buffer_.acquire() : 0;
 
-        RawRgbPacket *raw_packet = reinterpret_cast<RawRgbPacket *>(bb.data);
+      if(next != 0)
+      {
         RgbPacket rgb_packet;
-        rgb_packet.sequence = raw_packet->sequence;
-        rgb_packet.timestamp = footer->timestamp;
-        rgb_packet.jpeg_buffer = raw_packet->jpeg_buffer;
+        rgb_packet.sequence = raw_packet.sequence;
+        rgb_packet.timestamp = footer.timestamp;
         rgb_packet.jpeg_buffer_length = jpeg_length;
+        rgb_packet.memory = current_;
+        rgb_packet.trace = trace_;
+        rgb_packet.trace.mark(FrameTrace::ParserCommit);
+
+        if(fb.num_segments == 1 && fb.segments[0].offset == 0 && fb.segments[0].length == fb.length)
+        {
+          // the whole image is in one lent buffer, decode it in place
+          rgb_packet.jpeg_buffer = fb.segments[0].data + sizeof(RawRgbPacket);
+          fb.num_segments = 0;
+        }
+        else
+        {
+          // valid after PacketBuffer::gather(), if parts of it are lent
+          rgb_packet.jpeg_buffer = fb.data + sizeof(RawRgbPacket);
+        }
 
         // call the processor
         processor_->process(rgb_packet);
+        completed_frames_.fetch_add(1);
+
+        current_->release();
+        current_ = next;
       }
-      else
+      else if(accepted)
       {
-        std::cerr << "[RgbPacketStreamParser::onDataReceived] skipping rgb packet!" << std::endl;
+        std::cerr << "[RgbPacketStreamParser::onDataReceived] skipping rgb packet, no free buffer!" << std::endl;
+        dropped_busy_.fetch_add(1);
       }
 
-      // reset front buffer
-      buffer_.front().length = 0;
+      // reset current buffer
+      current_->clear();
     }
   }
+  else if(reference != 0)
+  {
+    reference->release();
+  }
 }
 
 } /* namespace libfreenect2 */
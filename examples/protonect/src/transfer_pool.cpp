@@ -34,17 +34,39 @@ namespace usb
 
 TransferPool::TransferPool(libusb_device_handle* device_handle, unsigned char device_endpoint) :
     callback_(0),
+    lend_buffers_(false),
+    completed_transfers_(0),
+    received_bytes_(0),
+    transfer_errors_(0),
+    iso_packet_errors_(0),
+    submit_failures_(0),
     device_handle_(device_handle),
     device_endpoint_(device_endpoint),
     buffer_(0),
     buffer_size_(0),
-    enable_submit_(false)
+    enable_submit_(false),
+    num_parallel_transfers_(0),
+    next_transfer_(0),
+    deallocate_pending_(false)
 {
 }
 
 TransferPool::~TransferPool()
 {
   deallocate();
+
+  // the lent buffers point into this pool, freeing it before they are released would leave them dangling
+  libfreenect2::unique_lock guard(stopped_mutex);
+
+  if(deallocate_pending_)
+  {
+    std::cerr << "[TransferPool::~TransferPool] transfer buffers are still lent, waiting for their release!" << std::endl;
+  }
+
+  while(deallocate_pending_)
+  {
+    WAIT_CONDITION(deallocated_, stopped_mutex, guard)
+  }
 }
 
 void TransferPool::enableSubmission()
@@ -59,6 +81,13 @@ void TransferPool::disableSubmission()
 
 void TransferPool::deallocate()
 {
+  // under the lock, so allocateTransfers() does not see a half deallocated pool
+  libfreenect2::lock_guard guard(stopped_mutex);
+
+  // the buffers are still used, the last release() deallocates
+  deallocate_pending_ = numTransfersLent() > 0;
+  if(deallocate_pending_) return;
+
   for(TransferQueue::iterator it = transfers_.begin(); it != transfers_.end(); ++it)
   {
     libusb_free_transfer(it->transfer);
@@ -71,6 +100,8 @@ void TransferPool::deallocate()
     buffer_ = 0;
     buffer_size_ = 0;
   }
+
+  deallocated_.notify_all();
 }
 
 void TransferPool::submit(size_t num_parallel_transfers)
@@ -81,24 +112,79 @@ void TransferPool::submit(size_t num_parallel_transfers)
     return;
   }
 
-  if(transfers_.size() < num_parallel_transfers)
+  num_parallel_transfers_ = num_parallel_transfers;
+
+  for(size_t i = 0; i < num_parallel_transfers; ++i)
   {
-    std::cerr << "[TransferPool::submit] too few idle transfers!" << std::endl;
+    Transfer *transfer;
+
+    {
+      libfreenect2::lock_guard guard(stopped_mutex);
+      transfer = idleTransfer(0);
+    }
+
+    if(transfer == 0)
+    {
+      std::cerr << "[TransferPool::submit] too few idle transfers!" << std::endl;
+      break;
+    }
+
+    submitTransfer(transfer);
   }
+}
 
-  for(size_t i = 0; i < num_parallel_transfers; ++i)
+void TransferPool::submitTransfer(TransferPool::Transfer *t)
+{
+  t->setStopped(false);
+
+  int r = libusb_submit_transfer(t->transfer);
+
+  if(r != LIBUSB_SUCCESS)
   {
-    libusb_transfer *transfer = transfers_[i].transfer;
-    transfers_[i].setStopped(false);
+    std::cerr << "[TransferPool::submitTransfer] failed to submit transfer: " << libusb_error_name(r) << std::endl;
+    submit_failures_.fetch_add(1);
+    t->setStopped(true);
+  }
+}
 
-    int r = libusb_submit_transfer(transfer);
+TransferPool::Transfer *TransferPool::idleTransfer(TransferPool::Transfer *except)
+{
+  // prefer submitting in index order, so consecutive data tends to be adjacent in memory
+  for(size_t i = 0; i < transfers_.size(); ++i)
+  {
+    size_t idx = (next_transfer_ + i) % transfers_.size();
+    Transfer *t = &transfers_[idx];
 
-    if(r != LIBUSB_SUCCESS)
+    if(t->stopped && !t->lent && t != except)
     {
-      std::cerr << "[TransferPool::submit] failed to submit transfer: " << libusb_error_name(r) << std::endl;
-      transfers_[i].setStopped(true);
+      // claim it, the caller submits it
+      t->stopped = false;
+      next_transfer_ = idx + 1;
+      return t;
     }
   }
+
+  return 0;
+}
+
+size_t TransferPool::numTransfersInFlight() const
+{
+  size_t n = 0;
+
+  for(TransferQueue::const_iterator it = transfers_.begin(); it != transfers_.end(); ++it)
+    n += !it->stopped;
+
+  return n;
+}
+
+size_t TransferPool::numTransfersLent() const
+{
+  size_t n = 0;
+
+  for(TransferQueue::const_iterator it = transfers_.begin(); it != transfers_.end(); ++it)
+    n += it->lent;
+
+  return n;
 }
 
 void TransferPool::cancel()
@@ -126,13 +212,45 @@ void TransferPool::cancel()
   }
 }
 
+TransferStatistics TransferPool::statistics() const
+{
+  TransferStatistics s;
+  s.transfers = completed_transfers_.load();
+  s.bytes = received_bytes_.load();
+  s.transfer_errors = transfer_errors_.load();
+  s.iso_packet_errors = iso_packet_errors_.load();
+  s.submit_failures = submit_failures_.load();
+  return s;
+}
+
 void TransferPool::setCallback(DataCallback *callback)
 {
   callback_ = callback;
 }
 
-void TransferPool::allocateTransfers(size_t num_transfers, size_t transfer_size)
+bool TransferPool::allocateTransfers(size_t num_transfers, size_t transfer_size)
 {
+  {
+    libfreenect2::unique_lock guard(stopped_mutex);
+
+    // the lent transfers of the previous allocation point into transfers_, which must not be reallocated before they are freed
+    if(deallocate_pending_)
+    {
+      std::cerr << "[TransferPool::allocateTransfers] waiting for the release of the previous transfers..." << std::endl;
+    }
+
+    while(deallocate_pending_)
+    {
+      WAIT_CONDITION(deallocated_, stopped_mutex, guard)
+    }
+
+    if(!transfers_.empty())
+    {
+      std::cerr << "[TransferPool::allocateTransfers] transfers are allocated already!" << std::endl;
+      return false;
+    }
+  }
+
   buffer_size_ = num_transfers * transfer_size;
   buffer_ = new unsigned char[buffer_size_];
   transfers_.reserve(num_transfers);
@@ -156,6 +274,8 @@ void TransferPool::allocateTransfers(size_t num_transfers, size_t transfer_size)
 
     ptr += transfer_size;
   }
+
+  return true;
 }
 
 void TransferPool::onTransferCompleteStatic(libusb_transfer* transfer)
@@ -172,8 +292,50 @@ void TransferPool::onTransferComplete(TransferPool::Transfer* t)
     return;
   }
 
+  if(t->transfer->status == LIBUSB_TRANSFER_COMPLETED)
+    completed_transfers_.fetch_add(1);
+  else
+    transfer_errors_.fetch_add(1);
+
+  // the buffer can be lent to the callback, if an idle transfer takes over its place in flight
+  bool lendable = false;
+
+  if(lend_buffers_ && enable_submit_)
+  {
+    libfreenect2::lock_guard guard(stopped_mutex);
+
+    for(TransferQueue::iterator it = transfers_.begin(); it != transfers_.end() && !lendable; ++it)
+      lendable = it->stopped && !it->lent && &(*it) != t;
+
+    if(lendable)
+    {
+      t->stopped = true;
+      t->lent = true;
+    }
+  }
+
   // process data
-  processTransfer(t->transfer);
+  bool lent = processTransfer(t->transfer, lendable ? t : 0);
+
+  if(lendable)
+  {
+    Transfer *replacement = 0;
+
+    {
+      libfreenect2::lock_guard guard(stopped_mutex);
+
+      if(!lent)
+        t->lent = false;
+
+      if(numTransfersInFlight() < num_parallel_transfers_)
+        replacement = idleTransfer(0);
+    }
+
+    if(replacement != 0)
+      submitTransfer(replacement);
+
+    return;
+  }
 
   if(!enable_submit_)
   {
@@ -187,22 +349,51 @@ void TransferPool::onTransferComplete(TransferPool::Transfer* t)
   if(r != LIBUSB_SUCCESS)
   {
     std::cerr << "[TransferPool::onTransferComplete] failed to submit transfer: " << libusb_error_name(r) << std::endl;
+    submit_failures_.fetch_add(1);
     t->setStopped(true);
   }
 }
 
+void TransferPool::onTransferReleased(TransferPool::Transfer *t)
+{
+  bool resubmit = false, deallocate_now = false;
+
+  {
+    libfreenect2::lock_guard guard(stopped_mutex);
+    t->lent = false;
+
+    if(deallocate_pending_)
+    {
+      deallocate_now = numTransfersLent() == 0;
+    }
+    else if(enable_submit_ && numTransfersInFlight() < num_parallel_transfers_)
+    {
+      // a replacement could not be submitted when the transfer was lent
+      t->stopped = false;
+      resubmit = true;
+    }
+  }
+
+  if(resubmit)
+    submitTransfer(t);
+
+  if(deallocate_now)
+    deallocate();
+}
+
 BulkTransferPool::BulkTransferPool(libusb_device_handle* device_handle, unsigned char device_endpoint) :
     TransferPool(device_handle, device_endpoint)
 {
+  lend_buffers_ = true;
 }
 
 BulkTransferPool::~BulkTransferPool()
 {
 }
 
-void BulkTransferPool::allocate(size_t num_transfers, size_t transfer_size)
+bool BulkTransferPool::allocate(size_t num_transfers, size_t transfer_size)
 {
-  allocateTransfers(num_transfers, transfer_size);
+  return allocateTransfers(num_transfers, transfer_size);
 }
 
 libusb_transfer* BulkTransferPool::allocateTransfer()
@@ -215,12 +406,19 @@ void BulkTransferPool::fillTransfer(libusb_transfer* transfer)
   transfer->type = LIBUSB_TRANSFER_TYPE_BULK;
 }
 
-void BulkTransferPool::processTransfer(libusb_transfer* transfer)
+bool BulkTransferPool::processTransfer(libusb_transfer* transfer, DataReference *reference)
 {
-  if(transfer->status != LIBUSB_TRANSFER_COMPLETED) return;
+  if(transfer->status != LIBUSB_TRANSFER_COMPLETED) return false;
+
+  received_bytes_.fetch_add(transfer->actual_length);
+
+  if(callback_ == 0) return false;
 
-  if(callback_)
-    callback_->onDataReceived(transfer->buffer, transfer->actual_length);
+  if(reference != 0)
+    return callback_->onDataLent(transfer->buffer, transfer->actual_length, reference);
+
+  callback_->onDataReceived(transfer->buffer, transfer->actual_length);
+  return false;
 }
 
 IsoTransferPool::IsoTransferPool(libusb_device_handle* device_handle, unsigned char device_endpoint) :
@@ -234,12 +432,12 @@ IsoTransferPool::~IsoTransferPool()
 {
 }
 
-void IsoTransferPool::allocate(size_t num_transfers, size_t num_packets, size_t packet_size)
+bool IsoTransferPool::allocate(size_t num_transfers, size_t num_packets, size_t packet_size)
 {
   num_packets_ = num_packets;
   packet_size_ = packet_size;
 
-  allocateTransfers(num_transfers, num_packets_ * packet_size_);
+  return allocateTransfers(num_transfers, num_packets_ * packet_size_);
 }
 
 libusb_transfer* IsoTransferPool::allocateTransfer()
@@ -255,19 +453,28 @@ void IsoTransferPool::fillTransfer(libusb_transfer* transfer)
   libusb_set_iso_packet_lengths(transfer, packet_size_);
 }
 
-void IsoTransferPool::processTransfer(libusb_transfer* transfer)
+bool IsoTransferPool::processTransfer(libusb_transfer* transfer, DataReference *reference)
 {
   unsigned char *ptr = transfer->buffer;
 
   for(size_t i = 0; i < num_packets_; ++i)
   {
-    if(transfer->iso_packet_desc[i].status != LIBUSB_TRANSFER_COMPLETED) continue;
+    if(transfer->iso_packet_desc[i].status != LIBUSB_TRANSFER_COMPLETED)
+    {
+      iso_packet_errors_.fetch_add(1);
+    }
+    else
+    {
+      received_bytes_.fetch_add(transfer->iso_packet_desc[i].actual_length);
 
-    if(callback_)
-      callback_->onDataReceived(ptr, transfer->iso_packet_desc[i].actual_length);
+      if(callback_)
+        callback_->onDataReceived(ptr, transfer->iso_packet_desc[i].actual_length);
+    }
 
     ptr += transfer->iso_packet_desc[i].length;
   }
+
+  return false;
 }
 
 } /* namespace usb */
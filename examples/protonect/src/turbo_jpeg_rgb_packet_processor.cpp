@@ -25,6 +25,7 @@
  */
 
 #include <libfreenect2/rgb_packet_processor.h>
+#include <libfreenect2/frame_pool.h>
 
 #include <opencv2/opencv.hpp>
 #include <turbojpeg.h>
@@ -39,6 +40,7 @@ public:
   tjhandle decompressor;
 
   Frame *frame;
+  FramePool *frame_pool;
 
   double timing_acc;
   double timing_acc_n;
@@ -53,6 +55,7 @@ public:
       std::cerr << "[TurboJpegRgbPacketProcessorImpl] Failed to initialize TurboJPEG decompressor! TurboJPEG error: '" << tjGetErrorStr() << "'" << std::endl;
     }
 
+    frame_pool = new FramePool(1920, 1080, tjPixelSize[TJPF_BGRX]);
     newFrame();
 
     timing_acc = 0.0;
@@ -69,11 +72,14 @@ public:
         std::cerr << "[~TurboJpegRgbPacketProcessorImpl] Failed to destroy TurboJPEG decompressor! TurboJPEG error: '" << tjGetErrorStr() << "'" << std::endl;
       }
     }
+
+    delete frame;
+    frame_pool->release();
   }
 
   void newFrame()
   {
-    frame = new Frame(1920, 1080, tjPixelSize[TJPF_BGRX]);
+    frame = frame_pool->allocate();
   }
 
   void startTiming()
@@ -114,11 +120,16 @@ void TurboJpegRgbPacketProcessor::process(const RgbPacket &packet)
 
     impl_->frame->timestamp = packet.timestamp;
     impl_->frame->sequence = packet.sequence;
+    impl_->frame->trace = packet.trace;
+    impl_->frame->trace.mark(FrameTrace::ProcessingStart);
 
     int r = tjDecompress2(impl_->decompressor, packet.jpeg_buffer, packet.jpeg_buffer_length, impl_->frame->data, 1920, 1920 * tjPixelSize[TJPF_BGRX], 1080, TJPF_BGRX, 0);
 
     if(r == 0)
     {
+      impl_->frame->trace.mark(FrameTrace::ProcessingEnd);
+      impl_->frame->trace.mark(FrameTrace::ListenerDelivery);
+
       if(listener_->onNewFrame(Frame::Color, impl_->frame))
       {
         impl_->newFrame();